@@ -0,0 +1,253 @@
+/*
+ * Implementation of the AssetPrefetcher class.
+ * Declaration for this class is in the header file (AssetPrefetcher.hpp)
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <thread>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "AssetPrefetcher.hpp"
+#include "ContentCache.hpp"
+#include "OpenBeneath.hpp"
+#include "UrlPath.hpp"
+
+// don't let a page with thousands of images queue up unbounded work
+static const size_t MAX_PENDING = 1024;
+
+// longer attribute values (inline data: URIs and the like) are skipped
+static const size_t MAX_REFERENCE = 4096;
+
+/*
+ * Constructor that ties the prefetcher to the cache it should fill
+ *
+ * @param cache The content cache used when serving files
+ */
+AssetPrefetcher::AssetPrefetcher(ContentCache &cache) : cache(cache), root_fd(-1) {
+}
+
+/*
+ * Start the background thread that loads queued assets
+ *
+ * @param root The directory root name, normalized the way the server uses it
+ * @param root_fd Open directory fd of the root, assets are opened beneath it
+ */
+void AssetPrefetcher::start(std::string root, int root_fd) {
+	this->root = root;
+	this->root_fd = root_fd;
+	std::thread loader(&AssetPrefetcher::run, this);
+	loader.detach();
+}
+
+/*
+ * Record the assets of an HTML page that was just read from disk and queue
+ * them for loading into the cache. Called whenever the page's contents are
+ * (re)loaded, so the graph follows edits to the page.
+ *
+ * @param page Path of the HTML file
+ * @param html Contents of the HTML file
+ */
+void AssetPrefetcher::pageLoaded(const std::string &page, const std::string &html) {
+	std::vector<std::string> assets = parseAssets(page, html);
+
+	std::lock_guard<std::mutex> lock(m);
+	graph[page] = assets;
+	for(const std::string &asset : assets) {
+		if(pending.size() < MAX_PENDING) {
+			pending.push_back(asset);
+		}
+	}
+	if(!assets.empty()) {
+		work_available.notify_one();
+	}
+}
+
+/*
+ * Look up the assets an HTML page is known to reference
+ *
+ * @param page Path of the HTML file
+ * @returns Paths of the page's assets, empty if the page hasn't been seen
+ */
+std::vector<std::string> AssetPrefetcher::dependencies(const std::string &page) {
+	std::lock_guard<std::mutex> lock(m);
+	auto found = graph.find(page);
+	if(found == graph.end()) {
+		return {};
+	}
+	return found->second;
+}
+
+/*
+ * Forget the assets waiting to be loaded, so they don't refill a cache that
+ * is being shrunk. Pages queue their assets again when they are next read.
+ *
+ * @returns How many assets were dropped
+ */
+size_t AssetPrefetcher::dropPending() {
+	std::lock_guard<std::mutex> lock(m);
+	size_t dropped = pending.size();
+	std::deque<std::string>().swap(pending);
+	return dropped;
+}
+
+/*
+ * Find the value of the href attribute of each <link> tag and the src
+ * attribute of each <img> and <script> tag. This is a single forward scan,
+ * so pages of any size (e.g. with large inline data: URIs) take time in
+ * proportion to their length and a fixed amount of stack.
+ *
+ * @param html Contents of the HTML file
+ * @returns The attribute values, in page order
+ */
+static std::vector<std::string> assetReferences(const std::string &html) {
+	auto space = [](char c) { return isspace((unsigned char) c) != 0; };
+	auto lower = [](std::string text) {
+		for(char &c : text) {
+			c = tolower((unsigned char) c);
+		}
+		return text;
+	};
+
+	std::vector<std::string> refs;
+	size_t n = html.size();
+	size_t pos = 0;
+	while((pos = html.find('<', pos)) != std::string::npos) {
+		pos++;
+		while(pos < n && space(html[pos])) {
+			pos++;
+		}
+		size_t name_start = pos;
+		while(pos < n && isalnum((unsigned char) html[pos])) {
+			pos++;
+		}
+		std::string tag = lower(html.substr(name_start, pos - name_start));
+		const char *wanted = (tag == "link") ? "href" : (tag == "img" || tag == "script") ? "src" : nullptr;
+		if(wanted == nullptr) {
+			continue;
+		}
+
+		// go through the tag's attributes up to its closing '>'
+		bool found = false;
+		while(pos < n && html[pos] != '>') {
+			if(space(html[pos]) || html[pos] == '/') {
+				pos++;
+				continue;
+			}
+			size_t attr_start = pos;
+			while(pos < n && !space(html[pos]) && html[pos] != '=' && html[pos] != '>' && html[pos] != '/') {
+				pos++;
+			}
+			std::string attr = lower(html.substr(attr_start, pos - attr_start));
+			while(pos < n && space(html[pos])) {
+				pos++;
+			}
+			if(pos >= n || html[pos] != '=') { // attribute without a value
+				continue;
+			}
+			pos++;
+			while(pos < n && space(html[pos])) {
+				pos++;
+			}
+
+			size_t value_start = pos;
+			size_t value_end;
+			if(pos < n && (html[pos] == '"' || html[pos] == '\'')) {
+				value_start = pos + 1;
+				value_end = html.find(html[pos], value_start);
+				if(value_end == std::string::npos) {
+					value_end = n;
+				}
+				pos = std::min(value_end + 1, n);
+			}
+			else {
+				while(pos < n && !space(html[pos]) && html[pos] != '>') {
+					pos++;
+				}
+				value_end = pos;
+			}
+
+			// only copy values short enough to be a path worth prefetching
+			if(!found && attr == wanted && value_end - value_start <= MAX_REFERENCE) {
+				refs.push_back(html.substr(value_start, value_end - value_start));
+				found = true;
+			}
+		}
+	}
+	return refs;
+}
+
+/*
+ * Find the same-origin files referenced by <link href>, <img src> and
+ * <script src> tags. References to other sites, other schemes and anything
+ * that resolves outside the root are ignored.
+ *
+ * @param page Path of the HTML file, for resolving relative references
+ * @param html Contents of the HTML file
+ * @returns Paths of the referenced files (root + request path), without
+ * duplicates
+ */
+std::vector<std::string> AssetPrefetcher::parseAssets(const std::string &page, const std::string &html) {
+	// resolve references against the page's URL, then canonicalize them the
+	// same way requests are, so "my%20file.css" keys as "my file.css"
+	std::string page_path = page.substr(root.length());
+	std::string page_dir = encodePath(page_path.substr(0, page_path.rfind('/') + 1));
+	std::vector<std::string> assets;
+
+	for(std::string ref : assetReferences(html)) {
+		// drop any query or fragment, they don't name a different file
+		size_t cut = ref.find_first_of("?#");
+		if(cut != std::string::npos) {
+			ref.erase(cut);
+		}
+		// skip other origins ("//host/...") and schemes ("http:", "data:", ...)
+		if(ref.empty() || ref.compare(0, 2, "//") == 0 || ref.find(':') != std::string::npos) {
+			continue;
+		}
+
+		// ".." stops at "/"; skip bad escapes and directories, which can't be cached
+		std::string target;
+		if(!normalizeRequestPath(ref[0] == '/' ? ref : page_dir + ref, target) || target.back() == '/') {
+			continue;
+		}
+
+		std::string asset = root + target;
+		bool seen = false;
+		for(const std::string &existing : assets) {
+			seen = seen || existing == asset;
+		}
+		if(!seen && asset != page) {
+			assets.push_back(asset);
+		}
+	}
+	return assets;
+}
+
+/*
+ * Background loop: take queued assets and load them into the cache, skipping
+ * ones that are already cached and current
+ */
+void AssetPrefetcher::run() {
+	while(true) {
+		std::string asset;
+		{
+			std::unique_lock<std::mutex> lock(m);
+			while(pending.empty()) {
+				work_available.wait(lock);
+			}
+			asset = pending.front();
+			pending.pop_front();
+		}
+
+		// the same lookup as serving, so links can't lead out of the root
+		int fd = openBeneath(root_fd, asset.substr(root.length()));
+		if(fd < 0) {
+			continue;
+		}
+		struct stat info;
+		if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && !cache.get(asset, info)) {
+			cache.load(asset, fd, info);
+		}
+		close(fd);
+	}
+}
@@ -0,0 +1,42 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ContentCache;
+
+/*
+ * Class that learns which files an HTML page pulls in (stylesheets, images
+ * and scripts) and loads them into the content cache in the background, so
+ * that the requests a browser makes right after fetching the page are hits.
+ *
+ * The page -> assets dependency graph is kept for later lookups. Pages and
+ * assets are named the way the server names the files it serves (and keys
+ * its cache), as the root followed by the canonical request path.
+ */
+class AssetPrefetcher {
+	public:
+		// public constructor
+		AssetPrefetcher(ContentCache &cache);
+
+		// public member functions
+		void start(std::string root, int root_fd);
+		void pageLoaded(const std::string &page, const std::string &html);
+		std::vector<std::string> dependencies(const std::string &page);
+		size_t dropPending();
+
+	private:
+		// private member variables
+		ContentCache &cache;
+		std::string root;
+		int root_fd;
+		std::unordered_map<std::string, std::vector<std::string>> graph;
+		std::deque<std::string> pending; // assets waiting to be loaded
+		std::mutex m;
+		std::condition_variable work_available;
+
+		std::vector<std::string> parseAssets(const std::string &page, const std::string &html);
+		void run();
+};
@@ -3,7 +3,11 @@
  * Declaration for this class is in the header file (BoundedBuffer.hpp)
  */
 
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include "BoundedBuffer.hpp"
 
 /*
@@ -17,31 +21,58 @@ BoundedBuffer::BoundedBuffer(int max_size) {
 	count = 0;
 	head = 0;
 	tail = 0;
+	num_items = 0;
+
+	// readable while there are items, so waiting for one can be combined
+	// with waiting for other things in poll()
+	ready_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+	if(ready_fd < 0) {
+		perror("eventfd");
+		exit(1);
+	}
 }
 
 /*
- * Get the first item in the buffer, then remove it
+ * Get the first item in the buffer and remove it, without waiting, along
+ * with when it was put in
  *
- * @returns item First item in buffer
+ * @param item Set to the first item in the buffer
+ * @param put_at Set to when putItem() was called for it, including any time
+ * spent waiting for space
+ * @returns true if there was an item, false if the buffer is empty
  */
-int BoundedBuffer::getItem() {
-	std::unique_lock<std::mutex> cv_lock(m); // aquire or wait for lock and shared mutex
-	while(count == 0) {
-		data_available.wait(cv_lock);
+bool BoundedBuffer::tryGetItem(int &item, std::chrono::steady_clock::time_point &put_at) {
+	std::unique_lock<std::mutex> cv_lock(m);
+	if(count == 0) {
+		return false;
 	}
+	takeFront(item, put_at);
+	space_available.notify_one();
+	return true;
+}
+
+/*
+ * Pop the first item; the caller holds the lock and has checked count
+ *
+ * @param item Set to the first item in the buffer
+ * @param put_at Set to when it was put in
+ */
+void BoundedBuffer::takeFront(int &item, std::chrono::steady_clock::time_point &put_at) {
 	count -= 1;
+	num_items.store(count, std::memory_order_relaxed);
 	// save item, then pop out of buffer
-	int item = this->buffer.front();
+	item = this->buffer.front().first;
+	put_at = this->buffer.front().second;
 	buffer.pop();
 	tail += 1;
 	if(tail == capacity) {
 		tail = 0;
 	}
-	// notify that there is buffer space available
-	space_available.notify_one();
-	cv_lock.unlock();
-	
-	return item;
+	// take one off the eventfd's count to match
+	uint64_t one;
+	if(read(ready_fd, &one, sizeof(one)) != sizeof(one)) {
+		perror("eventfd read");
+	}
 }
 
 /*
@@ -50,18 +81,40 @@ int BoundedBuffer::getItem() {
  * @param new_item The item to be added to the buffer
  */
 void BoundedBuffer::putItem(int new_item) {
+	std::chrono::steady_clock::time_point put_at = std::chrono::steady_clock::now();
 	std::unique_lock<std::mutex> cv_lock(m); // aquire or wait for lock and shared mutex
 	while(count == capacity) {
 		space_available.wait(cv_lock);
 	}
 	count += 1;
+	num_items.store(count, std::memory_order_relaxed);
 	// push item into buffer
-	buffer.push(new_item);
+	buffer.push({new_item, put_at});
 	head += 1;
 	if(head == capacity) {
 		head = 0;
 	}
-	// notify that there is data in the buffer
-	data_available.notify_one();
+	// consumers wait on the eventfd, not a condition variable
+	uint64_t one = 1;
+	if(write(ready_fd, &one, sizeof(one)) != sizeof(one)) {
+		perror("eventfd write");
+	}
 	cv_lock.unlock();
 }
+
+/*
+ * Check for items without taking the lock, so a consumer spinning on the
+ * buffer doesn't contend with putItem(). Only a hint: tryGetItem() decides.
+ *
+ * @returns true if the buffer had items when last changed
+ */
+bool BoundedBuffer::hasItems() {
+	return num_items.load(std::memory_order_relaxed) > 0;
+}
+
+/*
+ * @returns An eventfd that is readable while the buffer has items
+ */
+int BoundedBuffer::eventFd() {
+	return ready_fd;
+}
@@ -1,3 +1,5 @@
+#include <atomic>
+#include <chrono>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
@@ -5,6 +7,10 @@
 /*
  * Class representing a buffer with a fixed capacity
  *
+ * Each item remembers when it was put in, so the time it spent waiting can
+ * be measured (see tryGetItem). hasItems() reads an atomic copy of the item
+ * count without the lock, for spinning consumers to check cheaply.
+ *
  * Note that in C++, the header (i.e. hpp) file contains a declaration of the
  * class while the implementation of the constructors, destructors, and methods,
  * and given in an implementation (i.e. cpp) file.
@@ -15,8 +21,10 @@ class BoundedBuffer {
 		BoundedBuffer(int max_size);
 		
 		// public member functions
-		int getItem();
+		bool tryGetItem(int &item, std::chrono::steady_clock::time_point &put_at);
 		void putItem(int new_item);
+		bool hasItems();
+		int eventFd();
 
 		int count;
 		int head;
@@ -25,8 +33,11 @@ class BoundedBuffer {
 	private:
 		// private member variables
 		int capacity;
-		std::queue<int> buffer;
+		std::queue<std::pair<int, std::chrono::steady_clock::time_point>> buffer; // items and when they were put in
 		std::mutex m;
-		std::condition_variable data_available;
 		std::condition_variable space_available;
+		int ready_fd; // eventfd counting the items in the buffer
+		std::atomic<int> num_items; // count, readable without the lock
+
+		void takeFront(int &item, std::chrono::steady_clock::time_point &put_at);
 };
@@ -0,0 +1,97 @@
+/*
+ * Implementation of the cgroup limit functions.
+ * Declarations are in the header file (CgroupLimits.hpp)
+ */
+
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include "CgroupLimits.hpp"
+#include "NumaTopology.hpp"
+
+// where cgroup v2 is mounted: on its own, or beside v1 on hybrid hosts
+static const std::string CGROUP_ROOTS[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+
+/*
+ * Read the first line of a cgroup file
+ *
+ * @param path The file
+ * @returns Its first line, or "" if it can't be read
+ */
+static std::string readLine(const std::string &path) {
+	std::ifstream file(path);
+	std::string line;
+	getline(file, line);
+	return line;
+}
+
+/*
+ * Find this process's cgroup v2 directory, from the "0::/path" line of
+ * /proc/self/cgroup
+ *
+ * @returns The directory, or "" without cgroup v2
+ */
+std::string cgroupDir() {
+	std::ifstream cgroups("/proc/self/cgroup");
+	std::string line;
+	while(getline(cgroups, line)) {
+		if(line.compare(0, 3, "0::") != 0) {
+			continue;
+		}
+		for(const std::string &root : CGROUP_ROOTS) {
+			if(access((root + "/cgroup.controllers").c_str(), F_OK) == 0) {
+				std::string dir = root + line.substr(3);
+				if(dir.back() == '/') {
+					dir.pop_back();
+				}
+				return dir;
+			}
+		}
+	}
+	return "";
+}
+
+/*
+ * Read the limits that apply to this process, from its cgroup and all the
+ * cgroups above it
+ *
+ * @returns The tightest CPU and memory limits found
+ */
+CgroupLimits cgroupLimits() {
+	CgroupLimits limits{0, 0};
+	std::string dir = cgroupDir();
+	if(dir.empty()) {
+		return limits;
+	}
+
+	// the effective cpuset already takes the ancestors' cpusets into account
+	size_t cpuset = parseCpuList(readLine(dir + "/cpuset.cpus.effective")).size();
+	if(cpuset > 0) {
+		limits.cpus = cpuset;
+	}
+
+	// walk up from our cgroup through each parent to the root
+	while(access((dir + "/cgroup.controllers").c_str(), F_OK) == 0) {
+		// cpu.max is "quota period" in microseconds, or "max period"
+		std::istringstream cpu_max(readLine(dir + "/cpu.max"));
+		std::string quota;
+		double period = 0;
+		if(cpu_max >> quota >> period && quota != "max" && period > 0) {
+			double cpus = std::stod(quota) / period;
+			if(limits.cpus == 0 || cpus < limits.cpus) {
+				limits.cpus = cpus;
+			}
+		}
+
+		std::string memory_max = readLine(dir + "/memory.max");
+		if(!memory_max.empty() && memory_max != "max") {
+			size_t memory = std::stoull(memory_max);
+			if(limits.memory == 0 || memory < limits.memory) {
+				limits.memory = memory;
+			}
+		}
+
+		dir.erase(dir.rfind('/'));
+	}
+	return limits;
+}
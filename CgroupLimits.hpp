@@ -0,0 +1,18 @@
+#include <cstddef>
+#include <string>
+
+/*
+ * Functions for reading the CPU and memory limits of the cgroup (v2) this
+ * process runs in, so thread counts, queues and caches can be sized to the
+ * container rather than to the whole host.
+ *
+ * A limit set on any ancestor cgroup applies too, so the tightest one on the
+ * way up to the root is used. Hosts without cgroup v2 come back unlimited.
+ */
+struct CgroupLimits {
+	double cpus;   // CPUs' worth of time allowed by cpu.max and cpuset.cpus.effective, 0 if unknown
+	size_t memory; // memory.max in bytes, 0 if unlimited
+};
+
+CgroupLimits cgroupLimits();
+std::string cgroupDir();
@@ -0,0 +1,118 @@
+/*
+ * Implementation of the ClientLimiter class.
+ * Declaration for this class is in the header file (ClientLimiter.hpp)
+ */
+
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include "ClientLimiter.hpp"
+
+// upper bound on the fd table, in case RLIMIT_NOFILE is unlimited
+static const rlim_t MAX_TRACKED_FDS = 1 << 20;
+
+bool ClientKey::operator==(const ClientKey &other) const {
+	return memcmp(addr, other.addr, sizeof(addr)) == 0;
+}
+
+/*
+ * Hash the 16 address bytes by folding them into two 64-bit words
+ */
+size_t ClientKeyHash::operator()(const ClientKey &key) const {
+	uint64_t high, low;
+	memcpy(&high, key.addr, sizeof(high));
+	memcpy(&low, key.addr + sizeof(high), sizeof(low));
+	uint64_t h = (high ^ (low * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+	return h ^ (h >> 32);
+}
+
+/*
+ * Constructor that sets the per-client connection cap. The fd table is sized
+ * from the process's open file limit, since no socket can have a larger fd.
+ *
+ * @param max_per_client Most connections one address may hold, 0 for no cap
+ */
+ClientLimiter::ClientLimiter(int max_per_client) {
+	this->max_per_client = max_per_client;
+
+	struct rlimit limit;
+	rlim_t fds = MAX_TRACKED_FDS;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < fds) {
+		fds = limit.rlim_cur;
+	}
+	max_fds = fds;
+	owners.reset(new ClientKey[max_fds]);
+	tracked.reset(new bool[max_fds]());
+}
+
+/*
+ * Pick the shard responsible for a client
+ */
+ClientLimiter::Shard &ClientLimiter::shardFor(const ClientKey &key) {
+	return shards[ClientKeyHash()(key) % NUM_SHARDS];
+}
+
+/*
+ * Count a newly accepted connection against its client's limit
+ *
+ * @param sock The accepted socket
+ * @param addr The client's address, as filled in by accept()
+ * @returns true The connection may be served, false it is over the limit (in
+ * which case nothing is recorded and release() must not be called)
+ */
+bool ClientLimiter::acquire(int sock, const struct sockaddr_storage &addr) {
+	if(max_per_client <= 0 || sock < 0 || sock >= max_fds) {
+		return true;
+	}
+
+	ClientKey key;
+	if(addr.ss_family == AF_INET6) {
+		const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *) &addr;
+		memcpy(key.addr, &addr6->sin6_addr, sizeof(key.addr));
+	}
+	else if(addr.ss_family == AF_INET) { // store as ::ffff:a.b.c.d
+		const struct sockaddr_in *addr4 = (const struct sockaddr_in *) &addr;
+		memset(key.addr, 0, 10);
+		key.addr[10] = 0xff;
+		key.addr[11] = 0xff;
+		memcpy(key.addr + 12, &addr4->sin_addr, 4);
+	}
+	else {
+		return true;
+	}
+
+	Shard &shard = shardFor(key);
+	std::lock_guard<std::mutex> lock(shard.m);
+	int &count = shard.counts[key];
+	if(count >= max_per_client) {
+		return false; // count was already non-zero, so no empty entry is left behind
+	}
+	count += 1;
+	owners[sock] = key;
+	tracked[sock] = true;
+	return true;
+}
+
+/*
+ * Stop counting a connection. Must be called before the socket is closed,
+ * since after close() the fd number may be handed to a new connection.
+ *
+ * @param sock The socket that is about to be closed
+ */
+void ClientLimiter::release(int sock) {
+	if(sock < 0 || sock >= max_fds || !tracked[sock]) {
+		return;
+	}
+	tracked[sock] = false;
+	ClientKey key = owners[sock];
+
+	Shard &shard = shardFor(key);
+	std::lock_guard<std::mutex> lock(shard.m);
+	auto entry = shard.counts.find(key);
+	if(entry != shard.counts.end()) {
+		entry->second -= 1;
+		if(entry->second <= 0) {
+			shard.counts.erase(entry);
+		}
+	}
+}
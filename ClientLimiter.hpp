@@ -0,0 +1,57 @@
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <sys/socket.h>
+
+/*
+ * Key identifying a client address. IPv4 addresses are stored in their
+ * IPv4-mapped IPv6 form (::ffff:a.b.c.d) so the same client counts once no
+ * matter which listener (IPv4, IPv6 or dual-stack) it connected through.
+ */
+struct ClientKey {
+	uint8_t addr[16];
+
+	bool operator==(const ClientKey &other) const;
+};
+
+struct ClientKeyHash {
+	size_t operator()(const ClientKey &key) const;
+};
+
+/*
+ * Class that caps how many connections a single client address may have open
+ * at the same time.
+ *
+ * Counts live in a hash map split into shards, each with its own lock, so
+ * accepts and closes for different clients rarely contend. Entries are erased
+ * when their count drops to zero, keeping the map as small as the set of
+ * clients currently connected. The owner of every open socket is remembered
+ * in a table indexed by file descriptor so that release() only needs the fd.
+ */
+class ClientLimiter {
+	public:
+		// public constructor
+		ClientLimiter(int max_per_client);
+
+		// public member functions
+		bool acquire(int sock, const struct sockaddr_storage &addr);
+		void release(int sock);
+
+	private:
+		static const int NUM_SHARDS = 64;
+
+		struct Shard {
+			std::mutex m;
+			std::unordered_map<ClientKey, int, ClientKeyHash> counts;
+		};
+
+		// private member variables
+		int max_per_client;
+		int max_fds;
+		Shard shards[NUM_SHARDS];
+		std::unique_ptr<ClientKey[]> owners; // client of each tracked fd
+		std::unique_ptr<bool[]> tracked; // whether owners[fd] is in use
+
+		Shard &shardFor(const ClientKey &key);
+};
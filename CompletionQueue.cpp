@@ -0,0 +1,168 @@
+/*
+ * Implementation of the CompletionQueue class.
+ * Declaration for this class is in the header file (CompletionQueue.hpp)
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "CompletionQueue.hpp"
+#include "Job.hpp"
+
+/*
+ * Constructor that creates an empty queue, its eventfd and the epoll set
+ * for parked jobs
+ *
+ * @param park_limit Longest a job may stay parked before it is timed out
+ */
+CompletionQueue::CompletionQueue(std::chrono::steady_clock::duration park_limit) : park_limit(park_limit) {
+	num_jobs = 0;
+	ready_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(ready_fd < 0 || epoll_fd < 0) {
+		perror("eventfd/epoll");
+		exit(1);
+	}
+
+	// the eventfd is the one entry without a job pointer
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.ptr = nullptr;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ready_fd, &event);
+}
+
+/*
+ * Add a job that is ready and wake a network worker for it
+ *
+ * @param job The job
+ */
+void CompletionQueue::push(std::unique_ptr<Job> job) {
+	std::lock_guard<std::mutex> lock(m);
+	pushLocked(std::move(job));
+}
+
+/*
+ * Park a job until its client socket can take more data. It then comes out
+ * of tryPop() like any other job (also if the client hangs up, so the send
+ * that follows fails and the job is cleaned up).
+ *
+ * @param job The job, whose send would have blocked
+ */
+void CompletionQueue::pushWhenWritable(std::unique_ptr<Job> job) {
+	std::lock_guard<std::mutex> lock(m);
+	int client_sock = job->client_sock;
+	job->parked_at = std::chrono::steady_clock::now();
+	struct epoll_event event = {};
+	event.events = EPOLLOUT | EPOLLONESHOT;
+	event.data.ptr = job.get(); // owned by the epoll set until it fires or times out
+	parked.insert(job.get());
+
+	// a socket parked before is still registered, just disarmed
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client_sock, &event) != 0
+			&& epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sock, &event) != 0) {
+		perror("epoll_ctl");
+		parked.erase(job.get());
+		pushLocked(std::move(job));
+		return;
+	}
+	job.release();
+	num_jobs.store(jobs.size() + parked.size(), std::memory_order_relaxed);
+}
+
+/*
+ * Take the oldest ready job, if there is one, first moving any parked jobs
+ * whose sockets have become writable, or whose time is up, into the queue
+ *
+ * @returns The job, or nullptr if none is ready
+ */
+std::unique_ptr<Job> CompletionQueue::tryPop() {
+	std::lock_guard<std::mutex> lock(m);
+
+	struct epoll_event events[16];
+	int num_events = epoll_wait(epoll_fd, events, 16, 0);
+	for(int i = 0; i < num_events; i++) {
+		if(events[i].data.ptr != nullptr) {
+			Job *job = static_cast<Job *>(events[i].data.ptr);
+			parked.erase(job);
+			pushLocked(std::unique_ptr<Job>(job));
+		}
+	}
+	expireParked();
+
+	if(jobs.empty()) {
+		return nullptr;
+	}
+	std::unique_ptr<Job> job = std::move(jobs.front());
+	jobs.pop();
+	num_jobs.store(jobs.size() + parked.size(), std::memory_order_relaxed);
+
+	// take one off the eventfd's count to match; it is at least one since
+	// jobs are only queued with the lock held
+	uint64_t count;
+	if(read(ready_fd, &count, sizeof(count)) != sizeof(count)) {
+		perror("eventfd read");
+	}
+	return job;
+}
+
+/*
+ * Check for jobs without taking the lock. Parked jobs count too, since only
+ * tryPop() can tell whether their sockets are writable or their time is up.
+ * Only a hint: tryPop() decides.
+ *
+ * @returns true if jobs were queued or parked when the queue last changed
+ */
+bool CompletionQueue::mayHaveJobs() {
+	return num_jobs.load(std::memory_order_relaxed) > 0;
+}
+
+/*
+ * @returns An fd (for poll) that is readable while jobs are ready
+ */
+int CompletionQueue::eventFd() {
+	return epoll_fd;
+}
+
+/*
+ * Queue a job and count it on the eventfd; the caller holds the lock
+ *
+ * @param job The job
+ */
+void CompletionQueue::pushLocked(std::unique_ptr<Job> job) {
+	jobs.push(std::move(job));
+	num_jobs.store(jobs.size() + parked.size(), std::memory_order_relaxed);
+	uint64_t one = 1;
+	if(write(ready_fd, &one, sizeof(one)) != sizeof(one)) {
+		perror("eventfd write");
+	}
+}
+
+/*
+ * Once a second, take the jobs that have been parked for longer than the
+ * limit out of the epoll set and queue them with timed_out set; the caller
+ * holds the lock
+ */
+void CompletionQueue::expireParked() {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if(parked.empty() || now < next_expiry_check) {
+		return;
+	}
+	next_expiry_check = now + std::chrono::seconds(1);
+
+	for(auto it = parked.begin(); it != parked.end(); ) {
+		Job *job = *it;
+		if(now - job->parked_at < park_limit) {
+			++it;
+			continue;
+		}
+		// removing it also drops an event that fired but wasn't collected
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, job->client_sock, nullptr);
+		it = parked.erase(it);
+		job->timed_out = true;
+		pushLocked(std::unique_ptr<Job>(job));
+	}
+}
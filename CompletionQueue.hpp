@@ -0,0 +1,56 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_set>
+
+struct Job;
+
+/*
+ * Class representing a queue of jobs ready for a network worker: jobs back
+ * from the disk pool, jobs handed over from another lane, and jobs whose
+ * client socket has become writable again.
+ *
+ * Alongside the queue is an eventfd (in semaphore mode) whose count is the
+ * number of jobs waiting, so network workers can poll() it together with the
+ * connection buffer's eventfd and wake up for whichever has work. Jobs parked
+ * until their socket is writable are kept in an epoll set that also holds
+ * the eventfd, and eventFd() returns the epoll fd so one poll() covers both.
+ *
+ * A client that stops reading would keep its parked job (with its socket,
+ * file and connection slot) forever, so parked jobs have a time limit: once
+ * it passes, tryPop() hands the job out with timed_out set, for the worker
+ * to close. Workers taking parked jobs should call tryPop() at least every
+ * second or so for this to happen on time.
+ *
+ * mayHaveJobs() reads an atomic count of the queued and parked jobs without
+ * the lock or a syscall, so a spinning worker only calls tryPop() when it
+ * could return something.
+ */
+class CompletionQueue {
+	public:
+		// public constructor
+		CompletionQueue(std::chrono::steady_clock::duration park_limit);
+
+		// public member functions
+		void push(std::unique_ptr<Job> job);
+		void pushWhenWritable(std::unique_ptr<Job> job);
+		std::unique_ptr<Job> tryPop();
+		bool mayHaveJobs();
+		int eventFd();
+
+	private:
+		// private member variables
+		std::queue<std::unique_ptr<Job>> jobs;
+		std::unordered_set<Job *> parked; // jobs owned by the epoll set
+		std::chrono::steady_clock::duration park_limit;
+		std::chrono::steady_clock::time_point next_expiry_check;
+		std::mutex m;
+		int ready_fd;
+		int epoll_fd;
+		std::atomic<size_t> num_jobs; // queued plus parked, readable without the lock
+
+		void pushLocked(std::unique_ptr<Job> job);
+		void expireParked();
+};
@@ -0,0 +1,146 @@
+/*
+ * Implementation of the ContentCache class.
+ * Declaration for this class is in the header file (ContentCache.hpp)
+ */
+
+#include <cerrno>
+#include <unistd.h>
+#include "ContentCache.hpp"
+
+/*
+ * Constructor that sets how much file data the cache may hold
+ *
+ * @param budget Total bytes of file contents to keep
+ * @param max_object Largest single file that will be cached
+ */
+ContentCache::ContentCache(size_t budget, size_t max_object) {
+	this->budget = budget;
+	this->max_object = max_object;
+	used = 0;
+}
+
+/*
+ * Look up a file's contents
+ *
+ * @param path Path of the file
+ * @param info Current stat of the file, used to detect changes
+ * @returns The cached contents, or nullptr if not cached or out of date
+ */
+std::shared_ptr<const std::string> ContentCache::get(const std::string &path, const struct stat &info) {
+	std::lock_guard<std::mutex> lock(m);
+	auto found = entries.find(path);
+	if(found == entries.end()) {
+		return nullptr;
+	}
+
+	Entry &entry = found->second;
+	if(entry.size != info.st_size
+			|| entry.mtime.tv_sec != info.st_mtim.tv_sec
+			|| entry.mtime.tv_nsec != info.st_mtim.tv_nsec) {
+		return nullptr; // changed on disk, load() will replace it
+	}
+	if(entry.expires != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() >= entry.expires) {
+		return nullptr; // too old, insert() will replace it
+	}
+
+	lru.splice(lru.begin(), lru, entry.lru_pos); // move to front
+	return entry.data;
+}
+
+/*
+ * Read a file from disk and add it to the cache, replacing any older copy
+ *
+ * @param path Path of the file
+ * @param fd Open fd of the file, read with pread so its offset is untouched
+ * @param info Current stat of the file
+ * @returns The file's contents, or nullptr if it is too large to cache or
+ * could not be read
+ */
+std::shared_ptr<const std::string> ContentCache::load(const std::string &path, int fd, const struct stat &info) {
+	if(!S_ISREG(info.st_mode) || (size_t) info.st_size > max_object) {
+		return nullptr;
+	}
+
+	// read outside the lock so other threads can keep using the cache
+	std::string contents(info.st_size, '\0');
+	size_t done = 0;
+	while(done < contents.size()) {
+		ssize_t bytes = pread(fd, &contents[done], contents.size() - done, done);
+		if(bytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if(bytes <= 0) {
+			return nullptr; // file shrank or couldn't be read
+		}
+		done += bytes;
+	}
+	return insert(path, info, std::move(contents));
+}
+
+/*
+ * Add a file's contents that the caller already read, replacing any older copy
+ *
+ * @param path Path of the file
+ * @param info Stat of the file the contents were read from
+ * @param contents The file's contents, moved into the cache
+ * @param max_age How long the copy may be served for, or zero for as long as
+ * the stat matches
+ * @returns The cached contents
+ */
+std::shared_ptr<const std::string> ContentCache::insert(const std::string &path, const struct stat &info, std::string &&contents,
+		std::chrono::steady_clock::duration max_age) {
+	std::shared_ptr<const std::string> data = std::make_shared<const std::string>(std::move(contents));
+	std::chrono::steady_clock::time_point expires;
+	if(max_age != std::chrono::steady_clock::duration::zero()) {
+		expires = std::chrono::steady_clock::now() + max_age;
+	}
+
+	std::lock_guard<std::mutex> lock(m);
+	auto found = entries.find(path);
+	if(found != entries.end()) { // drop the out of date copy
+		used -= found->second.data->size();
+		lru.erase(found->second.lru_pos);
+		entries.erase(found);
+	}
+
+	lru.push_front(path);
+	entries[path] = Entry{data, info.st_mtim, info.st_size, expires, lru.begin()};
+	used += data->size();
+	evict();
+	return data;
+}
+
+/*
+ * @returns The size of the largest file the cache will hold
+ */
+size_t ContentCache::maxObjectSize() {
+	return max_object;
+}
+
+/*
+ * Change how much file data the cache may hold, dropping least recently
+ * used entries at once if it now holds too much
+ *
+ * @param budget Total bytes of file contents to keep
+ * @returns How many bytes of contents were dropped
+ */
+size_t ContentCache::setBudget(size_t budget) {
+	std::lock_guard<std::mutex> lock(m);
+	size_t used_before = used;
+	this->budget = budget;
+	evict();
+	return used_before - used;
+}
+
+/*
+ * Drop least recently used entries until the cache fits its budget.
+ * The caller must hold the lock.
+ */
+void ContentCache::evict() {
+	while(used > budget && !lru.empty()) {
+		auto victim = entries.find(lru.back());
+		used -= victim->second.data->size();
+		entries.erase(victim);
+		lru.pop_back();
+	}
+}
@@ -0,0 +1,54 @@
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/stat.h>
+
+/*
+ * Class holding the contents of recently served files in memory, up to a
+ * fixed budget of bytes. When the budget is exceeded the least recently used
+ * files are dropped first.
+ *
+ * Entries remember the size and modification time of the file they were
+ * read from, and a lookup only hits if those still match, so a file changed
+ * on disk is never served stale. Generated pages, such as directory
+ * listings, are keyed by the directory's stat the same way, and may also be
+ * given a maximum age for what the stat doesn't cover.
+ *
+ * The budget can be changed while the server runs, e.g. lowered under memory
+ * pressure and raised again once it is over.
+ */
+class ContentCache {
+	public:
+		// public constructor
+		ContentCache(size_t budget, size_t max_object);
+
+		// public member functions
+		std::shared_ptr<const std::string> get(const std::string &path, const struct stat &info);
+		std::shared_ptr<const std::string> load(const std::string &path, int fd, const struct stat &info);
+		std::shared_ptr<const std::string> insert(const std::string &path, const struct stat &info, std::string &&contents,
+				std::chrono::steady_clock::duration max_age = std::chrono::steady_clock::duration::zero());
+		size_t maxObjectSize();
+		size_t setBudget(size_t budget);
+
+	private:
+		struct Entry {
+			std::shared_ptr<const std::string> data;
+			struct timespec mtime;
+			off_t size;
+			std::chrono::steady_clock::time_point expires; // or the epoch for never
+			std::list<std::string>::iterator lru_pos;
+		};
+
+		// private member variables
+		size_t budget;
+		size_t max_object;
+		size_t used;
+		std::unordered_map<std::string, Entry> entries;
+		std::list<std::string> lru; // most recently used at the front
+		std::mutex m;
+
+		void evict();
+};
@@ -0,0 +1,139 @@
+/*
+ * Implementation of the DiskPool class.
+ * Declaration for this class is in the header file (DiskPool.hpp)
+ */
+
+#include <cerrno>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "DiskPool.hpp"
+#include "CompletionQueue.hpp"
+#include "Job.hpp"
+
+/*
+ * Constructor that starts the pool's threads
+ *
+ * @param num_threads Number of threads doing disk work
+ * @param max_queued Most jobs that may wait for a thread; trySubmit() refuses
+ * more than that
+ * @param work Does a job's disk work; runs on a pool thread
+ * @param fast_lane Where jobs go once their work is done
+ * @param bulk_lane Where bulk jobs go instead
+ */
+DiskPool::DiskPool(int num_threads, int max_queued, std::function<void(Job &)> work,
+		CompletionQueue &fast_lane, CompletionQueue &bulk_lane)
+		: work(work), fast_lane(fast_lane), bulk_lane(bulk_lane) {
+	this->max_queued = max_queued;
+	for(int i = 0; i < num_threads; i++) {
+		std::thread reader(&DiskPool::run, this);
+		reader.detach();
+	}
+}
+
+/*
+ * Hand a job to the pool, unless max_queued jobs are already waiting. It
+ * comes back through its lane's completion queue.
+ *
+ * @param job The job, with its stage set to the disk work it needs; moved
+ * from only if it was taken
+ * @returns false if the queue is full, and the caller still has the job
+ */
+bool DiskPool::trySubmit(std::unique_ptr<Job> &job) {
+	std::lock_guard<std::mutex> lock(m);
+	if((int) jobs.size() >= max_queued) {
+		return false;
+	}
+	jobs.push(std::move(job));
+	data_available.notify_one();
+	return true;
+}
+
+/*
+ * Read a whole file into memory, but only if that won't block on the disk
+ *
+ * @param fd Open fd of a regular file
+ * @param contents Resized to the file's size and filled with its contents
+ * @returns true if the file was read, false if part of it isn't in the page
+ * cache (contents are then incomplete)
+ */
+bool DiskPool::readNoWait(int fd, std::string &contents) {
+	size_t done = 0;
+	bool nowait = true;
+	while(done < contents.size()) {
+		struct iovec iov = { &contents[done], contents.size() - done };
+		ssize_t bytes = preadv2(fd, &iov, 1, done, nowait ? RWF_NOWAIT : 0);
+		if(bytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if(bytes < 0 && errno == EOPNOTSUPP) { // file system can't tell us, just read
+			nowait = false;
+			continue;
+		}
+		if(bytes < 0 && errno == EAGAIN) {
+			return false;
+		}
+		if(bytes <= 0) { // error, or file shrank; read what's left normally
+			return false;
+		}
+		done += bytes;
+	}
+	return true;
+}
+
+/*
+ * Check whether part of a file is in the page cache, using mincore() on a
+ * temporary mapping of it
+ *
+ * @param fd Open fd of a regular file
+ * @param offset Start of the range
+ * @param length Length of the range
+ * @returns true if every page of the range is resident (or the check itself
+ * isn't possible)
+ */
+bool DiskPool::isResident(int fd, off_t offset, off_t length) {
+	static const long page_size = sysconf(_SC_PAGESIZE);
+	off_t start = offset - offset % page_size; // mmap offsets must be page aligned
+	size_t map_length = length + (offset - start);
+
+	void *map = mmap(nullptr, map_length, PROT_READ, MAP_SHARED, fd, start);
+	if(map == MAP_FAILED) {
+		return true;
+	}
+
+	std::vector<unsigned char> pages((map_length + page_size - 1) / page_size);
+	bool resident = true;
+	if(mincore(map, map_length, pages.data()) == 0) {
+		for(unsigned char page : pages) {
+			if(!(page & 1)) {
+				resident = false;
+				break;
+			}
+		}
+	}
+	munmap(map, map_length);
+	return resident;
+}
+
+/*
+ * Thread loop: take jobs, do their disk work and pass them on
+ */
+void DiskPool::run() {
+	while(true) {
+		std::unique_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(m);
+			while(jobs.empty()) {
+				data_available.wait(lock);
+			}
+			job = std::move(jobs.front());
+			jobs.pop();
+		}
+		work(*job);
+		CompletionQueue &lane = job->bulk ? bulk_lane : fast_lane;
+		lane.push(std::move(job));
+	}
+}
@@ -0,0 +1,49 @@
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <sys/types.h>
+
+struct Job;
+class CompletionQueue;
+
+/*
+ * Class representing a bounded pool of threads that do the disk work which
+ * could block (open, stat, getdents, read), so the network workers never
+ * wait on the disk.
+ *
+ * Network workers do what they can without blocking: paths whose lookup is
+ * in the dentry cache and data that is in the page cache (readNoWait,
+ * isResident). Anything else is submitted to the pool. A pool thread runs
+ * the work function on the job and pushes it onto the completion queue of
+ * the job's lane, whose eventfd wakes a network worker to carry on with the
+ * response. The queue is bounded and a full one refuses jobs rather than
+ * making the network worker wait, so a slow disk can't hold up requests
+ * that never touch it.
+ */
+class DiskPool {
+	public:
+		// public constructor
+		DiskPool(int num_threads, int max_queued, std::function<void(Job &)> work,
+				CompletionQueue &fast_lane, CompletionQueue &bulk_lane);
+
+		// public member functions
+		bool trySubmit(std::unique_ptr<Job> &job);
+
+		static bool readNoWait(int fd, std::string &contents);
+		static bool isResident(int fd, off_t offset, off_t length);
+
+	private:
+		// private member variables
+		int max_queued;
+		std::function<void(Job &)> work;
+		CompletionQueue &fast_lane;
+		CompletionQueue &bulk_lane;
+		std::queue<std::unique_ptr<Job>> jobs;
+		std::mutex m;
+		std::condition_variable data_available;
+
+		void run();
+};
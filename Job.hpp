@@ -0,0 +1,55 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * One client request on its way through the server. Network workers parse
+ * it and do all the socket I/O; whenever it needs something that could wait
+ * on the disk (opening, stat'ing or listing a path, reading a file that isn't
+ * in the page cache) it is handed to the disk pool, which does that one step
+ * and hands it back through a CompletionQueue.
+ */
+struct Job {
+	// The disk work the job was last handed to the pool for
+	enum Stage {
+		RESOLVE, // open and stat the path, list directories, read small files
+		READ,    // read a small file into the content cache
+		WARM     // read the next slice of a large file into the page cache
+	};
+
+	int client_sock;
+	int shard = 0; // the NUMA node shard whose workers serve it
+	Stage stage = RESOLVE;
+	bool bulk = false; // on the bulk lane, for large file bodies
+
+	// the parsed request
+	std::string path;  // canonical request path, e.g. "/docs/"
+	std::string query; // without the '?'
+	bool wants_json = false;
+	bool early_hints_ok = false;
+
+	// what the path resolved to
+	bool resolved = false;
+	int status = 0;           // prebuilt status response to send instead, or 0
+	std::string location;     // where to redirect, for directories without a '/'
+	std::string filename;     // file to send (root + path, plus any index name)
+	int file_fd = -1;         // owned by the job
+	struct stat info;
+	std::shared_ptr<const std::string> body; // listing, or cached file contents
+	std::string content_type; // of a listing
+
+	// when it reached each stage, for the Server-Timing header
+	std::chrono::steady_clock::time_point accepted;    // put in the shard's buffer
+	std::chrono::steady_clock::time_point picked_up;   // taken by a network worker
+	std::chrono::steady_clock::time_point parsed;      // request read and parsed
+	std::chrono::steady_clock::time_point resolved_at; // path resolved
+	const char *cache = "none"; // "hit", "miss", or "bypass" for bodies sent from the file
+
+	// how far the response has got
+	bool header_sent = false;
+	off_t offset = 0; // bytes of the file body sent
+	std::chrono::steady_clock::time_point parked_at; // last parked waiting for the socket
+	bool timed_out = false; // parked too long, the client stopped reading
+};
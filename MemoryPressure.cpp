@@ -0,0 +1,226 @@
+/*
+ * Implementation of the MemoryPressure class.
+ * Declaration for this class is in the header file (MemoryPressure.hpp)
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <malloc.h>
+#include <poll.h>
+#include <unistd.h>
+#include "MemoryPressure.hpp"
+#include "AssetPrefetcher.hpp"
+#include "CgroupLimits.hpp"
+#include "ContentCache.hpp"
+
+// PSI trigger: some task stalled on memory for 150 ms within a 2 s window
+// (unprivileged triggers need a window that is a multiple of 2 s)
+static const char PSI_TRIGGER[] = "some 150000 2000000";
+
+// halvings of the budget before the caches are emptied altogether
+static const int MAX_LEVEL = 4;
+
+// how long without pressure before the budget is raised a step, and the
+// least time between two steps down
+static const std::chrono::seconds RELAX_AFTER(30);
+static const std::chrono::seconds SHRINK_INTERVAL(1);
+
+/**
+ * @returns Resident memory of this process in MB, from /proc
+ */
+static double residentMB() {
+	std::ifstream statm("/proc/self/statm");
+	long pages = 0, resident = 0;
+	statm >> pages >> resident;
+	return resident * (double) sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+/*
+ * Constructor that opens the pressure signals. Either may be missing (no
+ * PSI in the kernel, no cgroup v2), in which case the other is used alone.
+ *
+ * @param caches The content caches to shrink
+ * @param prefetchers The prefetchers filling those caches
+ * @param budget The caches' normal budget in bytes
+ */
+MemoryPressure::MemoryPressure(std::vector<ContentCache *> caches, std::vector<AssetPrefetcher *> prefetchers,
+		size_t budget) : caches(caches), prefetchers(prefetchers) {
+	full_budget = budget;
+	level = 0;
+	event_counts = 0;
+	last_pressure = std::chrono::steady_clock::now();
+
+	psi_fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if(psi_fd >= 0 && write(psi_fd, PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) < 0) {
+		close(psi_fd);
+		psi_fd = -1;
+	}
+
+	events_fd = -1;
+	std::string dir = cgroupDir();
+	if(!dir.empty()) {
+		events_fd = open((dir + "/memory.events").c_str(), O_RDONLY | O_CLOEXEC);
+	}
+	if(events_fd >= 0) {
+		eventsIncreased(); // take the current counts as the baseline
+	}
+}
+
+/*
+ * Start the thread that waits for pressure, if there is anything to wait on
+ */
+void MemoryPressure::start() {
+	if(psi_fd < 0 && events_fd < 0) {
+		std::cerr << "No PSI or cgroup memory.events, caches won't shrink under memory pressure\n";
+		return;
+	}
+	std::thread monitor(&MemoryPressure::run, this);
+	monitor.detach();
+}
+
+/*
+ * Change the caches' normal budget, keeping any halving in force
+ *
+ * @param budget The new budget in bytes
+ */
+void MemoryPressure::setBudget(size_t budget) {
+	std::lock_guard<std::mutex> lock(m);
+	full_budget = budget;
+	for(ContentCache *cache : caches) {
+		cache->setBudget(budgetAt(level));
+	}
+}
+
+/*
+ * Monitor loop: shrink on every pressure signal, and grow back a step at a
+ * time once pressure has been gone for a while
+ */
+void MemoryPressure::run() {
+	while(true) {
+		struct pollfd fds[2];
+		int num_fds = 0;
+		if(psi_fd >= 0) {
+			fds[num_fds++] = {psi_fd, POLLPRI, 0};
+		}
+		if(events_fd >= 0) {
+			fds[num_fds++] = {events_fd, POLLPRI, 0};
+		}
+
+		int ready = poll(fds, num_fds, 1000);
+		if(ready < 0 && errno != EINTR) {
+			perror("Waiting for memory pressure failed");
+			return;
+		}
+
+		for(int i = 0; i < num_fds && ready > 0; i++) {
+			if(fds[i].fd == psi_fd && (fds[i].revents & POLLERR)) {
+				std::cerr << "PSI memory trigger went away\n";
+				close(psi_fd);
+				psi_fd = -1;
+			}
+			else if(fds[i].fd == psi_fd && (fds[i].revents & POLLPRI)) {
+				shrink("PSI memory stall");
+			}
+			else if(fds[i].fd == events_fd && fds[i].revents != 0 && eventsIncreased()) {
+				shrink("cgroup memory.events");
+			}
+		}
+
+		relax();
+	}
+}
+
+/*
+ * Read memory.events and compare its counters with the last read
+ *
+ * @returns true if the cgroup hit its high or max limit, or an OOM, since
+ */
+bool MemoryPressure::eventsIncreased() {
+	char text[512];
+	ssize_t length = pread(events_fd, text, sizeof(text) - 1, 0);
+	if(length <= 0) {
+		return false;
+	}
+	text[length] = '\0';
+
+	long total = 0;
+	std::istringstream events(text);
+	std::string name;
+	long count;
+	while(events >> name >> count) {
+		if(name == "high" || name == "max" || name == "oom" || name == "oom_kill") {
+			total += count;
+		}
+	}
+	bool increased = total > event_counts;
+	event_counts = total;
+	return increased;
+}
+
+/*
+ * Go a step down: halve the caches' budget (or empty them at the last step),
+ * drop queued prefetches and return the freed memory to the kernel
+ *
+ * @param cause What signalled the pressure, for the log
+ */
+void MemoryPressure::shrink(const char *cause) {
+	std::lock_guard<std::mutex> lock(m);
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	bool too_soon = (now - last_pressure < SHRINK_INTERVAL);
+	last_pressure = now;
+	if(level == MAX_LEVEL || (too_soon && level > 0)) {
+		return;
+	}
+	level++;
+
+	double resident_before = residentMB();
+	size_t dropped = 0;
+	size_t prefetches = 0;
+	for(ContentCache *cache : caches) {
+		dropped += cache->setBudget(budgetAt(level));
+	}
+	for(AssetPrefetcher *prefetcher : prefetchers) {
+		prefetches += prefetcher->dropPending();
+	}
+	// the dropped contents went back to malloc; have it give the pages back
+	malloc_trim(0);
+
+	char report[256];
+	snprintf(report, sizeof(report), "Memory pressure (%s): cache budget %zu MB -> %zu MB per node, dropped "
+			"%.1f MB of files and %zu queued prefetches, resident %.1f MB -> %.1f MB\n", cause,
+			budgetAt(level - 1) / (1024 * 1024), budgetAt(level) / (1024 * 1024), dropped / (1024 * 1024.0),
+			prefetches, resident_before, residentMB());
+	std::cerr << report;
+}
+
+/*
+ * Go a step back up after a quiet spell: double the caches' budget
+ */
+void MemoryPressure::relax() {
+	std::lock_guard<std::mutex> lock(m);
+	if(level == 0 || std::chrono::steady_clock::now() - last_pressure < RELAX_AFTER) {
+		return;
+	}
+	level--;
+	for(ContentCache *cache : caches) {
+		cache->setBudget(budgetAt(level));
+	}
+	last_pressure = std::chrono::steady_clock::now(); // wait again before the next step
+	std::cerr << "Memory pressure over: cache budget back to " << budgetAt(level) / (1024 * 1024)
+		<< " MB per node\n";
+}
+
+/*
+ * @param step How many times the budget has been halved
+ * @returns The caches' budget after that many steps
+ */
+size_t MemoryPressure::budgetAt(int step) {
+	return (step >= MAX_LEVEL) ? 0 : full_budget >> step;
+}
@@ -0,0 +1,51 @@
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+class ContentCache;
+class AssetPrefetcher;
+
+/*
+ * Class that watches for memory pressure and shrinks the server's caches
+ * before the kernel (or the container's OOM killer) has to step in.
+ *
+ * Pressure is signalled by a PSI trigger on /proc/pressure/memory (tasks
+ * stalled on memory for long enough within a window) and by the high, max
+ * and OOM counters in the cgroup's memory.events going up. Each signal
+ * halves the content caches' budget, down to nothing after a few steps,
+ * drops queued prefetches and hands freed heap memory back to the kernel.
+ * Once no pressure has been seen for a while the budget is doubled again,
+ * a step at a time. Every step is logged with what it dropped.
+ *
+ * The normal budget itself can change too, e.g. when the container's memory
+ * limit does; any halving in force applies to the new budget.
+ */
+class MemoryPressure {
+	public:
+		// public constructor
+		MemoryPressure(std::vector<ContentCache *> caches, std::vector<AssetPrefetcher *> prefetchers,
+				size_t budget);
+
+		// public member functions
+		void start();
+		void setBudget(size_t budget);
+
+	private:
+		// private member variables
+		std::vector<ContentCache *> caches;
+		std::vector<AssetPrefetcher *> prefetchers;
+		size_t full_budget;
+		int level; // how many times the budget has been halved
+		int psi_fd;
+		int events_fd;
+		long event_counts; // sum of the memory.events counters we react to
+		std::chrono::steady_clock::time_point last_pressure;
+		std::mutex m;
+
+		void run();
+		bool eventsIncreased();
+		void shrink(const char *cause);
+		void relax();
+		size_t budgetAt(int step);
+};
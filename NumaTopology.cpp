@@ -0,0 +1,120 @@
+/*
+ * Implementation of the NUMA topology functions.
+ * Declarations are in the header file (NumaTopology.hpp)
+ */
+
+#include <fstream>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include "NumaTopology.hpp"
+
+static const std::string NODE_DIR = "/sys/devices/system/node/";
+
+/*
+ * Read the first line of a sysfs file
+ *
+ * @param path The file
+ * @returns Its first line, or "" if it can't be read
+ */
+static std::string readLine(const std::string &path) {
+	std::ifstream file(path);
+	std::string line;
+	getline(file, line);
+	return line;
+}
+
+/*
+ * Turn a kernel CPU or node list such as "0-3,8-11" into its numbers
+ *
+ * @param list The list, in the format of sysfs cpulist files
+ * @returns Every number in it, in order
+ */
+std::vector<int> parseCpuList(const std::string &list) {
+	std::vector<int> cpus;
+	std::istringstream ranges(list);
+	std::string range;
+	while(getline(ranges, range, ',')) {
+		if(range.empty()) {
+			continue;
+		}
+		size_t dash = range.find('-');
+		try {
+			int first = std::stoi(range.substr(0, dash));
+			int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+			for(int cpu = first; cpu <= last; cpu++) {
+				cpus.push_back(cpu);
+			}
+		}
+		catch(const std::exception &e) { // malformed, skip this range
+		}
+	}
+	return cpus;
+}
+
+/*
+ * Find the NUMA nodes this process can run on
+ *
+ * @returns One entry per node with at least one allowed CPU; never empty
+ */
+std::vector<NumaNode> numaNodes() {
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+
+	std::vector<NumaNode> nodes;
+	for(int id : parseCpuList(readLine(NODE_DIR + "online"))) {
+		NumaNode node{id, {}, {}};
+		std::string cpulist = readLine(NODE_DIR + "node" + std::to_string(id) + "/cpulist");
+		node.all_cpus = parseCpuList(cpulist);
+		for(int cpu : node.all_cpus) {
+			if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+				node.cpus.push_back(cpu);
+			}
+		}
+		if(!node.cpus.empty()) { // memory-only nodes have no CPUs
+			nodes.push_back(node);
+		}
+	}
+
+	if(nodes.empty()) {
+		NumaNode node{0, {}, parseCpuList(readLine("/sys/devices/system/cpu/online"))};
+		for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if(CPU_ISSET(cpu, &allowed)) {
+				node.cpus.push_back(cpu);
+			}
+		}
+		if(node.all_cpus.empty()) {
+			node.all_cpus = node.cpus;
+		}
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+/*
+ * Find the CPUs isolated from the scheduler at boot (isolcpus=)
+ *
+ * @returns The isolated CPUs, empty if there are none
+ */
+std::vector<int> isolatedCpus() {
+	return parseCpuList(readLine("/sys/devices/system/cpu/isolated"));
+}
+
+/*
+ * Restrict the calling thread to a set of CPUs. Threads it creates from
+ * then on start with the same set.
+ *
+ * @param cpus The CPUs to run on
+ * @returns true if the thread was pinned
+ */
+bool pinThread(const std::vector<int> &cpus) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(int cpu : cpus) {
+		if(cpu < CPU_SETSIZE) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,27 @@
+#include <string>
+#include <vector>
+
+/*
+ * Functions for finding the host's NUMA nodes and the CPUs that belong to
+ * each, read from /sys/devices/system/node, and for pinning a thread to a
+ * set of CPUs.
+ *
+ * Only CPUs this process is allowed to run on are counted, and nodes left
+ * without any are dropped. Each node also lists all of its online CPUs,
+ * since CPUs isolated with isolcpus= are normally outside the affinity mask
+ * a process inherits but can still be pinned to explicitly. Hosts without the sysfs files (or a kernel built
+ * without NUMA) come back as one node holding every allowed CPU.
+ *
+ * isolatedCpus lists the CPUs kept free of ordinary scheduling with the
+ * isolcpus= boot option, for threads that should have a core to themselves.
+ */
+struct NumaNode {
+	int id;
+	std::vector<int> cpus;     // the node's CPUs this process may run on
+	std::vector<int> all_cpus; // every online CPU of the node
+};
+
+std::vector<NumaNode> numaNodes();
+std::vector<int> parseCpuList(const std::string &list);
+bool pinThread(const std::vector<int> &cpus);
+std::vector<int> isolatedCpus();
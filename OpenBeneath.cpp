@@ -0,0 +1,112 @@
+/*
+ * Implementation of the openBeneath function.
+ * Declaration is in the header file (OpenBeneath.hpp)
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "OpenBeneath.hpp"
+
+/*
+ * Open a path relative to a directory one component at a time, for kernels
+ * without openat2. No component may be a symbolic link (O_NOFOLLOW) or "..",
+ * so this can't leave the directory either; it is stricter than openat2, as
+ * links that stay inside the directory are refused too.
+ *
+ * @param dir_fd Directory the path is relative to
+ * @param relative Path to open, without a leading '/'
+ * @param flags Flags for opening the last component
+ * @returns An open fd for the file or directory, or -1 with errno set
+ */
+static int openNoFollow(int dir_fd, const std::string &relative, int flags) {
+	std::vector<std::string> components;
+	std::istringstream stream(relative);
+	std::string component;
+	while(getline(stream, component, '/')) {
+		if(component == "..") {
+			errno = EXDEV;
+			return -1;
+		}
+		if(!component.empty() && component != ".") {
+			components.push_back(component);
+		}
+	}
+	if(components.empty()) {
+		return openat(dir_fd, ".", flags);
+	}
+
+	// walk the directories with O_PATH fds, which only name a place
+	int dir = dir_fd;
+	for(size_t i = 0; i + 1 < components.size(); i++) {
+		int next = openat(dir, components[i].c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		int saved_errno = errno;
+		if(dir != dir_fd) {
+			close(dir);
+		}
+		if(next < 0) {
+			errno = saved_errno;
+			return -1;
+		}
+		dir = next;
+	}
+	int fd = openat(dir, components.back().c_str(), flags | O_NOFOLLOW);
+	int saved_errno = errno;
+	if(dir != dir_fd) {
+		close(dir);
+	}
+	errno = saved_errno;
+	return fd;
+}
+
+/*
+ * Open a path relative to a directory without ever leaving that directory:
+ * ".." past the top and symbolic links pointing outside it fail with EXDEV,
+ * so requests can't reach files outside the root however they are written.
+ * Kernels without openat2 get the same guarantee from openNoFollow, which
+ * refuses every symbolic link.
+ *
+ * @param dir_fd Directory the path is relative to (e.g. root_fd)
+ * @param path Path to open; a leading '/' is ignored
+ * @param cached_only Fail with EAGAIN rather than wait for the disk, when
+ * some part of the lookup isn't in the dentry cache
+ * @returns An open read-only fd for the file or directory, or -1 with errno set
+ */
+int openBeneath(int dir_fd, std::string path, bool cached_only) {
+	size_t start = path.find_first_not_of('/');
+	std::string relative = (start == std::string::npos) ? "." : path.substr(start);
+
+	// O_NONBLOCK so that opening a FIFO doesn't hang the worker; it has no
+	// effect on reading regular files or directories
+	struct open_how how;
+	memset(&how, 0, sizeof(how));
+	how.flags = O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+	how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+	if(cached_only) {
+		how.resolve |= RESOLVE_CACHED;
+	}
+
+	int fd;
+	do { // EAGAIN means a concurrent rename raced the lookup, just retry
+		fd = syscall(SYS_openat2, dir_fd, relative.c_str(), &how, sizeof(how));
+	} while(fd < 0 && errno == EAGAIN && !cached_only);
+
+	if(fd < 0 && errno == EINVAL && cached_only) { // kernel older than 5.12
+		errno = EAGAIN; // can't tell, so leave it to the disk pool
+		return -1;
+	}
+
+	if(fd < 0 && errno == ENOSYS) { // kernel older than 5.6
+		if(cached_only) {
+			errno = EAGAIN;
+			return -1;
+		}
+		fd = openNoFollow(dir_fd, relative, how.flags);
+	}
+	return fd;
+}
@@ -0,0 +1,8 @@
+#include <string>
+
+/*
+ * Function for opening request paths beneath the document root, used both
+ * when serving and when prefetching, so both follow the same rules about
+ * which files under the root can be reached.
+ */
+int openBeneath(int dir_fd, std::string path, bool cached_only = false);
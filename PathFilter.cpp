@@ -0,0 +1,345 @@
+/*
+ * Implementation of the PathFilter class.
+ * Declaration for this class is in the header file (PathFilter.hpp)
+ */
+
+#include <cerrno>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "PathFilter.hpp"
+
+namespace fs = std::filesystem;
+
+// Bloom filter sizing: ~10 bits per path and 7 probes gives about a 1% false
+// positive rate. The filter is sized for twice the snapshot so that files
+// created later don't push that rate up right away.
+static const size_t BITS_PER_PATH = 10;
+static const int NUM_PROBES = 7;
+static const size_t MIN_BLOOM_BITS = 1 << 16;
+
+static const uint32_t WATCH_MASK = IN_CREATE | IN_MOVED_TO | IN_ONLYDIR;
+
+/*
+ * Constructor that sets how large the snapshot and negative cache may be
+ *
+ * @param max_snapshot Most paths to put in the Bloom filter; larger roots
+ * use only the negative cache
+ * @param max_negative Most missing paths to remember
+ */
+PathFilter::PathFilter(size_t max_snapshot, size_t max_negative) :
+		ready(false), use_bloom(false) {
+	this->max_snapshot = max_snapshot;
+	this->max_negative = max_negative;
+	bloom_num_bits = 0;
+	inotify_fd = -1;
+}
+
+/*
+ * Start the background thread that snapshots the root and watches it
+ *
+ * @param root The directory root name
+ */
+void PathFilter::start(std::string root) {
+	this->root = key(root);
+	std::thread watcher(&PathFilter::run, this);
+	watcher.detach();
+}
+
+/*
+ * Turn a path into the form stored in the filter: lexically normalized and
+ * without a trailing slash, so "WWW/test/dir/" and "WWW//test/dir" match the
+ * "WWW/test/dir" found while scanning. This is string work only, no syscalls.
+ */
+std::string PathFilter::key(const std::string &path) {
+	std::string normal = fs::path(path).lexically_normal().string();
+	while(normal.length() > 1 && normal.back() == '/') {
+		normal.pop_back();
+	}
+	return normal;
+}
+
+/*
+ * Check, without touching the disk, whether a path certainly doesn't exist
+ *
+ * @param path Path of the requested file or directory (root included)
+ * @returns true The path is known not to exist, false it may exist
+ */
+bool PathFilter::definitelyMissing(const std::string &path) {
+	if(!ready.load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	std::string path_key = key(path);
+	if(use_bloom.load(std::memory_order_acquire) && !bloomMightContain(path_key)) {
+		return true;
+	}
+
+	std::lock_guard<std::mutex> lock(negative_mutex);
+	return negative.count(path_key) > 0;
+}
+
+/*
+ * Remember a path that was looked up on disk and found missing
+ *
+ * @param path Path of the requested file or directory (root included)
+ */
+void PathFilter::recordMissing(const std::string &path) {
+	if(!ready.load(std::memory_order_acquire)) {
+		return; // nothing would invalidate it yet
+	}
+
+	std::string path_key = key(path);
+	std::lock_guard<std::mutex> lock(negative_mutex);
+	if(negative.insert(path_key).second) {
+		negative_order.push_back(path_key);
+		if(negative_order.size() > max_negative) {
+			negative.erase(negative_order.front());
+			negative_order.pop_front();
+		}
+	}
+}
+
+/*
+ * Set a path's bits in the Bloom filter. Probes are derived from one string
+ * hash by double hashing (h1 + i * h2).
+ */
+void PathFilter::bloomAdd(const std::string &path_key) {
+	uint64_t h1 = std::hash<std::string>()(path_key);
+	uint64_t h2 = ((h1 >> 33) ^ h1) * 0xff51afd7ed558ccdULL | 1;
+	for(int i = 0; i < NUM_PROBES; i++) {
+		size_t bit = (h1 + i * h2) % bloom_num_bits;
+		bloom_bits[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+	}
+}
+
+/*
+ * Check a path's bits in the Bloom filter
+ */
+bool PathFilter::bloomMightContain(const std::string &path_key) {
+	uint64_t h1 = std::hash<std::string>()(path_key);
+	uint64_t h2 = ((h1 >> 33) ^ h1) * 0xff51afd7ed558ccdULL | 1;
+	for(int i = 0; i < NUM_PROBES; i++) {
+		size_t bit = (h1 + i * h2) % bloom_num_bits;
+		if(!(bloom_bits[bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Forget all remembered missing paths, since one of them may now exist
+ */
+void PathFilter::clearNegative() {
+	std::lock_guard<std::mutex> lock(negative_mutex);
+	negative.clear();
+	negative_order.clear();
+}
+
+/*
+ * Check whether a path, with all its symbolic links resolved, is the root or
+ * inside it
+ *
+ * @param path Path to check
+ * @returns false if it leads outside the root or can't be resolved
+ */
+bool PathFilter::insideRoot(const std::string &path) {
+	char *real = realpath(path.c_str(), nullptr);
+	if(real == nullptr) {
+		return false;
+	}
+	std::string real_path = real;
+	free(real);
+	std::string prefix = (real_root == "/") ? real_root : real_root + "/";
+	return real_path == real_root || real_path.compare(0, prefix.length(), prefix) == 0;
+}
+
+/*
+ * Watch a directory and everything below it, collecting the paths found.
+ * Symbolic links to directories inside the root are followed, so a
+ * directory reachable by two paths is scanned under both. Links that lead
+ * out of the root are not, since the server refuses to serve through them
+ * (see openBeneath), and neither is a link back to one of its own
+ * ancestors, to end loops.
+ *
+ * @param dir Directory to scan, in key form
+ * @param found Paths found so far; the scan stops adding once limit is hit
+ * @param limit Most paths to collect
+ * @param ancestors (dev, inode) of the directories above dir in this scan
+ * @returns false if a directory couldn't be watched (changes could be missed)
+ */
+bool PathFilter::scan(const std::string &dir, std::vector<std::string> &found, size_t limit,
+		std::set<std::pair<uint64_t, uint64_t>> &ancestors) {
+	struct stat info;
+	if(stat(dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+		return true; // not a directory, or removed since we heard about it
+	}
+	std::pair<uint64_t, uint64_t> id(info.st_dev, info.st_ino);
+	if(ancestors.count(id) > 0) {
+		return true;
+	}
+	struct stat link_info;
+	if(lstat(dir.c_str(), &link_info) == 0 && S_ISLNK(link_info.st_mode) && !insideRoot(dir)) {
+		return true;
+	}
+
+	// watch before reading, so entries created meanwhile aren't missed
+	int wd = inotify_add_watch(inotify_fd, dir.c_str(), WATCH_MASK);
+	if(wd < 0) {
+		perror("Watching document root failed");
+		return false;
+	}
+	watched[wd].insert(dir);
+
+	DIR *dir_stream = opendir(dir.c_str());
+	if(dir_stream == nullptr) {
+		return true; // unreadable directories can't be served anyway
+	}
+
+	std::vector<std::string> subdirs;
+	struct dirent *entry;
+	while((entry = readdir(dir_stream)) != nullptr) {
+		std::string name = entry->d_name;
+		if(name == "." || name == "..") {
+			continue;
+		}
+		std::string path = dir + "/" + name;
+		if(found.size() < limit) {
+			found.push_back(path);
+		}
+		if(entry->d_type == DT_DIR || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+			subdirs.push_back(path);
+		}
+	}
+	closedir(dir_stream);
+
+	ancestors.insert(id);
+	bool ok = true;
+	for(const std::string &subdir : subdirs) {
+		if(!scan(subdir, found, limit, ancestors)) {
+			ok = false;
+			break;
+		}
+	}
+	ancestors.erase(id);
+	return ok;
+}
+
+/*
+ * Watch and collect a directory tree, starting a fresh ancestor chain
+ */
+bool PathFilter::scan(const std::string &dir, std::vector<std::string> &found, size_t limit) {
+	std::set<std::pair<uint64_t, uint64_t>> ancestors;
+	return scan(dir, found, limit, ancestors);
+}
+
+/*
+ * Background loop: snapshot the root, then apply inotify events forever
+ */
+void PathFilter::run() {
+	inotify_fd = inotify_init1(IN_CLOEXEC);
+	if(inotify_fd < 0) {
+		perror("inotify_init1 failed, 404s will be checked on disk");
+		return;
+	}
+
+	char *real = realpath(root.c_str(), nullptr);
+	if(real == nullptr) {
+		perror("Resolving document root failed, 404s will be checked on disk");
+		return;
+	}
+	real_root = real;
+	free(real);
+
+	// one more than the limit, so we can tell when the root is too big
+	std::vector<std::string> found;
+	found.push_back(root);
+	if(!scan(root, found, max_snapshot + 1)) {
+		return; // can't see every change, so never answer from memory
+	}
+
+	if(found.size() <= max_snapshot) {
+		bloom_num_bits = std::max(MIN_BLOOM_BITS, found.size() * 2 * BITS_PER_PATH);
+		bloom_num_bits = (bloom_num_bits + 63) / 64 * 64;
+		bloom_bits.reset(new std::atomic<uint64_t>[bloom_num_bits / 64]());
+		for(const std::string &path : found) {
+			bloomAdd(path);
+		}
+		use_bloom.store(true, std::memory_order_release);
+	}
+	found.clear();
+	ready.store(true, std::memory_order_release);
+
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while(true) {
+		ssize_t length = read(inotify_fd, events, sizeof(events));
+		if(length < 0 && errno == EINTR) {
+			continue;
+		}
+		if(length <= 0) {
+			perror("Reading inotify events failed");
+			ready.store(false, std::memory_order_release);
+			return;
+		}
+
+		for(char *ptr = events; ptr < events + length; ) {
+			struct inotify_event *event = (struct inotify_event *) ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+
+			if(event->mask & IN_Q_OVERFLOW) {
+				// events were lost, so rescan everything; the Bloom filter
+				// only grows, so re-adding what's there is all it takes
+				ready.store(false, std::memory_order_release);
+				clearNegative();
+				watched.clear();
+				std::vector<std::string> rescanned;
+				if(!scan(root, rescanned, SIZE_MAX)) {
+					return;
+				}
+				if(use_bloom.load(std::memory_order_relaxed)) {
+					for(const std::string &path : rescanned) {
+						bloomAdd(path);
+					}
+				}
+				ready.store(true, std::memory_order_release);
+				continue;
+			}
+			if(event->mask & IN_IGNORED) { // directory removed, watch is gone
+				watched.erase(event->wd);
+				continue;
+			}
+
+			auto dir = watched.find(event->wd);
+			if(dir == watched.end() || event->len == 0) {
+				continue;
+			}
+
+			// something appeared: add it under every path its directory is
+			// known by, and if it is (or links to) a directory, everything
+			// inside it, before dropping the negative cache
+			std::vector<std::string> added;
+			std::set<std::string> prefixes = dir->second; // scan() may add to it
+			for(const std::string &prefix : prefixes) {
+				std::string path = prefix + "/" + event->name;
+				added.push_back(path);
+				if(!scan(path, added, SIZE_MAX)) {
+					ready.store(false, std::memory_order_release);
+					return;
+				}
+			}
+			if(use_bloom.load(std::memory_order_relaxed)) {
+				for(const std::string &added_path : added) {
+					bloomAdd(added_path);
+				}
+			}
+			clearNegative();
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/*
+ * Class that answers "does this path exist under the root?" from memory, so
+ * requests for missing paths can get a 404 without touching the disk.
+ *
+ * At startup a background thread snapshots every path under the root into a
+ * Bloom filter. A Bloom filter can say a path might exist when it doesn't,
+ * but never the reverse, so a miss in the filter is a sure 404. Paths the
+ * filter lets through that turn out to be missing are remembered in a small
+ * negative cache. If the root has too many paths to snapshot, only the
+ * negative cache is used.
+ *
+ * inotify keeps both honest: new files are added to the filter and any
+ * creation clears the negative cache. Until the snapshot is done, or if
+ * inotify isn't available, every lookup goes to the disk as before.
+ */
+class PathFilter {
+	public:
+		// public constructor
+		PathFilter(size_t max_snapshot, size_t max_negative);
+
+		// public member functions
+		void start(std::string root);
+		bool definitelyMissing(const std::string &path);
+		void recordMissing(const std::string &path);
+
+	private:
+		// private member variables
+		size_t max_snapshot;
+		size_t max_negative;
+		std::string root;
+		std::string real_root; // root with every symbolic link resolved
+		std::atomic<bool> ready; // snapshot done and changes are being watched
+		std::atomic<bool> use_bloom;
+
+		std::unique_ptr<std::atomic<uint64_t>[]> bloom_bits;
+		size_t bloom_num_bits;
+
+		std::unordered_set<std::string> negative;
+		std::deque<std::string> negative_order; // oldest first, for eviction
+		std::mutex negative_mutex;
+
+		int inotify_fd;
+		// watch descriptor -> every path the directory is reachable by
+		std::unordered_map<int, std::set<std::string>> watched;
+
+		static std::string key(const std::string &path);
+		void bloomAdd(const std::string &key);
+		bool bloomMightContain(const std::string &key);
+		void clearNegative();
+		bool insideRoot(const std::string &path);
+		bool scan(const std::string &dir, std::vector<std::string> &found, size_t limit,
+				std::set<std::pair<uint64_t, uint64_t>> &ancestors);
+		bool scan(const std::string &dir, std::vector<std::string> &found, size_t limit);
+		void run();
+};
@@ -0,0 +1,66 @@
+/*
+ * Implementation of the SpinWait class.
+ * Declaration for this class is in the header file (SpinWait.hpp)
+ */
+
+#include <algorithm>
+#include <sched.h>
+#include "SpinWait.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() asm volatile("yield" ::: "memory")
+#else
+#define CPU_RELAX() asm volatile("" ::: "memory")
+#endif
+
+// bounds of the adaptive spin limit, in idle iterations, and the yields tried
+// after spinning before blocking. An iteration is a pause plus the worker's
+// lock-free queue checks, measured at 30ns to 55ns in the worker loop on a
+// Xeon, so the limit spans roughly 0.1ms to 5ms of spinning.
+static const unsigned MIN_SPINS = 1 << 11;
+static const unsigned MAX_SPINS = 1 << 17;
+static const unsigned YIELDS = 64;
+
+/*
+ * Constructor that starts the spin limit halfway up
+ */
+SpinWait::SpinWait() {
+	spin_limit = MIN_SPINS << 3;
+	spins = 0;
+}
+
+/*
+ * Call when a poll of the thread's queues found nothing to do
+ *
+ * @returns true to poll again right away, false when the thread should block
+ * until woken (the wait then starts over)
+ */
+bool SpinWait::idle() {
+	spins++;
+	if(spins <= spin_limit) {
+		CPU_RELAX();
+		return true;
+	}
+	if(spins <= spin_limit + YIELDS) {
+		sched_yield();
+		return true;
+	}
+
+	// nothing came in time: spin less before blocking next time
+	spin_limit = std::max(MIN_SPINS, spin_limit / 2);
+	spins = 0;
+	return false;
+}
+
+/*
+ * Call when a poll found work; adjusts the limit to how long the wait was
+ */
+void SpinWait::busy() {
+	if(spins > spin_limit / 2) { // nearly missed it, allow longer waits
+		spin_limit = std::min(MAX_SPINS, spin_limit * 2);
+	}
+	spins = 0;
+}
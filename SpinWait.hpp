@@ -0,0 +1,24 @@
+/*
+ * Class representing the idle loop of a busy-polling thread: instead of
+ * sleeping as soon as there is nothing to do, it spins for a while (with the
+ * CPU's pause hint), then yields the CPU for a while, and only then tells
+ * the caller to block.
+ *
+ * The spin limit adapts. When work shows up while spinning, the limit grows
+ * to cover that wait next time; when the spinning runs out without work, it
+ * shrinks, so an idle thread soon stops burning its core.
+ */
+class SpinWait {
+	public:
+		// public constructor
+		SpinWait();
+
+		// public member functions
+		bool idle();
+		void busy();
+
+	private:
+		// private member variables
+		unsigned spin_limit;
+		unsigned spins;
+};
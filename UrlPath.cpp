@@ -0,0 +1,168 @@
+/*
+ * Implementation of the request path functions.
+ * Declarations are in the header file (UrlPath.hpp)
+ */
+
+#include "UrlPath.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Find the first byte of the path that needs rewriting: a '%', or a '/'
+ * followed by '.' or another '/'
+ *
+ * @param path The raw path
+ * @returns Index of the first such byte, or path.length() if there is none
+ */
+static size_t findSpecial(const std::string &path) {
+	const char *data = path.data();
+	size_t length = path.length();
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i percent = _mm_set1_epi8('%');
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i dot = _mm_set1_epi8('.');
+
+	// compare each 16 byte block, and the block one byte later, so that a
+	// '/' at position j can be checked against the byte at j + 1
+	for(; i + 17 <= length; i += 16) {
+		__m128i here = _mm_loadu_si128((const __m128i *) (data + i));
+		__m128i next = _mm_loadu_si128((const __m128i *) (data + i + 1));
+		__m128i hits = _mm_or_si128(
+				_mm_cmpeq_epi8(here, percent),
+				_mm_and_si128(_mm_cmpeq_epi8(here, slash),
+					_mm_or_si128(_mm_cmpeq_epi8(next, dot), _mm_cmpeq_epi8(next, slash))));
+		int mask = _mm_movemask_epi8(hits);
+		if(mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+	for(; i < length; i++) {
+		if(data[i] == '%') {
+			return i;
+		}
+		if(data[i] == '/' && i + 1 < length && (data[i + 1] == '.' || data[i + 1] == '/')) {
+			return i;
+		}
+	}
+	return length;
+}
+
+/*
+ * Value of a hex digit, or -1 if the character isn't one
+ */
+static int hexValue(char c) {
+	if(c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if(c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if(c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+/*
+ * Turn a request target's path into its canonical form
+ *
+ * @param raw The path as sent by the client (without any query string)
+ * @param canonical Set to the canonical path, which starts with '/' and ends
+ * with '/' exactly when the raw path did (or its last segment was a dot
+ * segment); may be the same string as raw
+ * @returns false if the path is malformed: not starting with '/', a bad
+ * percent escape, or an encoded NUL byte
+ */
+bool normalizeRequestPath(const std::string &raw, std::string &canonical) {
+	if(raw.empty() || raw[0] != '/') {
+		return false;
+	}
+
+	size_t first = findSpecial(raw);
+	if(first == raw.length()) { // already canonical, the common case
+		canonical = raw;
+		return true;
+	}
+
+	// percent-decode everything from the first special byte on
+	std::string decoded(raw, 0, first);
+	decoded.reserve(raw.length());
+	for(size_t i = first; i < raw.length(); i++) {
+		if(raw[i] != '%') {
+			decoded += raw[i];
+			continue;
+		}
+		if(i + 2 >= raw.length()) {
+			return false;
+		}
+		int high = hexValue(raw[i + 1]);
+		int low = hexValue(raw[i + 2]);
+		if(high < 0 || low < 0 || (high == 0 && low == 0)) {
+			return false; // not hex, or %00 which would cut the path short
+		}
+		decoded += (char) (high * 16 + low);
+		i += 2;
+	}
+
+	// then rebuild it segment by segment, dropping empty and "." segments
+	// and letting ".." remove the segment before it
+	std::string result = "/";
+	size_t start = 1;
+	while(start <= decoded.length()) {
+		size_t end = decoded.find('/', start);
+		if(end == std::string::npos) {
+			end = decoded.length();
+		}
+		bool last = (end == decoded.length());
+		std::string segment = decoded.substr(start, end - start);
+
+		if(segment == "..") {
+			if(result.length() > 1) { // drop the previous segment, keeping its '/'
+				size_t cut = result.rfind('/', result.length() - 2);
+				result.erase(cut + 1);
+			}
+		}
+		else if(!segment.empty() && segment != ".") {
+			result += segment;
+			if(!last) {
+				result += '/';
+			}
+		}
+		start = end + 1;
+	}
+
+	canonical = result;
+	return true;
+}
+
+/*
+ * Percent-encode a canonical path for use in a URL (e.g. a Location header),
+ * leaving '/' and the unreserved characters as they are
+ *
+ * @param path A canonical path
+ * @returns The path with every other byte written as %XX
+ */
+std::string encodePath(const std::string &path) {
+	static const char hex[] = "0123456789ABCDEF";
+	std::string encoded;
+	encoded.reserve(path.length());
+	for(unsigned char c : path) {
+		bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+			|| c == '-' || c == '.' || c == '_' || c == '~' || c == '/';
+		if(plain) {
+			encoded += c;
+		}
+		else {
+			encoded += '%';
+			encoded += hex[c >> 4];
+			encoded += hex[c & 15];
+		}
+	}
+	return encoded;
+}
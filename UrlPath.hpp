@@ -0,0 +1,14 @@
+#include <string>
+
+/*
+ * Functions for turning the path of a request target into the canonical form
+ * used to open files and as the key for the server's caches, and back.
+ *
+ * normalizeRequestPath percent-decodes the path, collapses repeated slashes
+ * and removes "." and ".." segments (".." never goes above "/"). Most paths
+ * need none of that, so they are first scanned 16 bytes at a time with SSE2
+ * for '%', "/." and "//"; only paths containing one are rewritten, starting
+ * from the first hit. Other targets use the same scan one byte at a time.
+ */
+bool normalizeRequestPath(const std::string &raw, std::string &canonical);
+std::string encodePath(const std::string &path);
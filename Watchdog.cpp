@@ -0,0 +1,99 @@
+/*
+ * Implementation of the Watchdog class.
+ * Declaration for this class is in the header file (Watchdog.hpp)
+ */
+
+#include <iostream>
+#include <thread>
+#include <sys/socket.h>
+#include "Watchdog.hpp"
+
+/*
+ * Constructor for a watchdog with no workers yet, not checking anything
+ * until start() is called
+ */
+Watchdog::Watchdog() : limit(0), force_close(false), stall_count(0) {
+}
+
+/*
+ * Start the thread that checks the workers' stamps
+ *
+ * @param limit How long a worker may spend on one stage of a connection
+ * @param force_close Whether to shut down the connection of a stuck worker
+ */
+void Watchdog::start(std::chrono::seconds limit, bool force_close) {
+	this->limit = limit;
+	this->force_close = force_close;
+	std::thread checker(&Watchdog::run, this);
+	checker.detach();
+}
+
+/*
+ * Give a worker thread a progress stamp
+ *
+ * @param name How the worker is named in reports
+ * @returns The worker's stamp, valid for as long as the watchdog
+ */
+Watchdog::Progress &Watchdog::addWorker(const std::string &name) {
+	std::lock_guard<std::mutex> lock(workers_mutex);
+	workers.emplace_back();
+	workers.back().name = name;
+	return workers.back();
+}
+
+/*
+ * Record that the worker starts a stage of a connection
+ *
+ * @param client_sock The connection's socket
+ * @param activity What the worker is doing with it
+ * @param path The requested path, if known yet
+ */
+void Watchdog::Progress::begin(int client_sock, Activity activity, const std::string &path) {
+	std::lock_guard<std::mutex> lock(m);
+	this->activity = activity;
+	this->client_sock = client_sock;
+	this->path = path;
+	since = std::chrono::steady_clock::now();
+	reported = false;
+}
+
+/*
+ * Record that the worker is done with its connection. Call this before the
+ * socket is closed or handed to another thread, so the watchdog never shuts
+ * down an fd that has been reused.
+ */
+void Watchdog::Progress::end() {
+	std::lock_guard<std::mutex> lock(m);
+	activity = IDLE;
+	client_sock = -1;
+}
+
+/*
+ * Checker loop: once a second, report (and optionally cut off) every worker
+ * that has been on one stage for longer than the limit, once per stage
+ */
+void Watchdog::run() {
+	static const char *activities[] = {"idle", "receiving the request", "responding"};
+	while(true) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		std::lock_guard<std::mutex> workers_lock(workers_mutex);
+		for(Progress &stamp : workers) {
+			std::lock_guard<std::mutex> lock(stamp.m);
+			if(stamp.activity == IDLE || stamp.reported || now - stamp.since < limit) {
+				continue;
+			}
+			stamp.reported = true;
+			long count = ++stall_count;
+
+			auto stuck = std::chrono::duration_cast<std::chrono::seconds>(now - stamp.since).count();
+			std::cerr << "Watchdog: " << stamp.name << " stuck " << stuck << " s " << activities[stamp.activity]
+				<< " on fd " << stamp.client_sock << " (" << (stamp.path.empty() ? "no path yet" : stamp.path)
+				<< "), stall #" << count << (force_close ? ", closing the connection" : "") << "\n";
+			if(force_close) {
+				shutdown(stamp.client_sock, SHUT_RDWR);
+			}
+		}
+	}
+}
@@ -0,0 +1,57 @@
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+
+/*
+ * Class that notices network workers stuck on one connection, e.g. blocked
+ * in send() for minutes to a peer that stopped reading, which would
+ * otherwise quietly take a worker out of service.
+ *
+ * Each worker registers for a progress stamp and updates it as it takes a
+ * connection, moves to another stage of it and lets it go. Only the worker
+ * and the watchdog touch a stamp, so its lock is uncontended. A watchdog
+ * thread checks the stamps every second and reports a worker that has spent
+ * longer than the limit on one stage, with its fd and path, counting every
+ * stall. Optionally it also shuts the connection down, which makes the
+ * worker's blocked recv() or send() return so it can close the connection
+ * and carry on.
+ */
+class Watchdog {
+	public:
+		enum Activity {IDLE, RECEIVING, RESPONDING};
+
+		// One worker's progress stamp, updated only by that worker
+		class Progress {
+			public:
+				void begin(int client_sock, Activity activity, const std::string &path);
+				void end();
+
+			private:
+				friend class Watchdog;
+				std::mutex m; // also held while the watchdog shuts the connection down
+				std::string name;
+				Activity activity = IDLE;
+				int client_sock = -1;
+				std::string path;
+				std::chrono::steady_clock::time_point since;
+				bool reported = false;
+		};
+
+		// public constructor
+		Watchdog();
+
+		// public member functions
+		void start(std::chrono::seconds limit, bool force_close);
+		Progress &addWorker(const std::string &name);
+
+	private:
+		// private member variables
+		std::deque<Progress> workers; // a deque so stamps never move
+		std::mutex workers_mutex;
+		std::chrono::seconds limit;
+		bool force_close;
+		long stall_count; // only used by the checker thread
+
+		void run();
+};
@@ -0,0 +1,74 @@
+/*
+ * Implementation of the access log functions.
+ * Declarations are in the header file (AccessLog.hpp)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <regex>
+
+#include "AccessLog.hpp"
+
+/**
+ * Parse the time of a log entry, e.g. "10/Oct/2024:13:55:36 -0700"
+ *
+ * @param text The text between the square brackets
+ * @returns Seconds since the epoch, or -1 if it can't be parsed
+ */
+double parseLogTime(const std::string &text) {
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	const char *rest = strptime(text.c_str(), "%d/%b/%Y:%H:%M:%S", &tm);
+	if(rest == nullptr) {
+		return -1;
+	}
+	double seconds = timegm(&tm);
+
+	// apply the UTC offset, so logs spanning a DST change stay in order
+	int offset;
+	if(sscanf(rest, " %d", &offset) == 1) {
+		int sign = offset < 0 ? -1 : 1;
+		offset *= sign;
+		seconds -= sign * ((offset / 100) * 3600 + (offset % 100) * 60);
+	}
+	return seconds;
+}
+
+/**
+ * Read the requests of an access log
+ *
+ * @param filename The log file
+ * @returns Its entries, in log order; lines that don't parse are skipped
+ */
+std::vector<LogEntry> readLog(const std::string &filename) {
+	std::ifstream log(filename);
+	if(!log.is_open()) {
+		perror(("Opening " + filename + " failed").c_str());
+		exit(1);
+	}
+
+	// host ident user [time] "request" status bytes, then anything
+	// (Combined Log Format adds the referrer and user agent)
+	std::regex line_regex("^\\S+ \\S+ \\S+ \\[([^\\]]+)\\] \"(\\S+) (\\S+)[^\"]*\" (\\d{3}) (\\d+|-)");
+	std::vector<LogEntry> entries;
+	std::string line;
+	size_t skipped = 0;
+	while(getline(log, line)) {
+		std::smatch match;
+		double time;
+		if(!std::regex_search(line, match, line_regex) || (time = parseLogTime(match[1])) < 0) {
+			skipped++;
+			continue;
+		}
+		long bytes = (match[5] == "-") ? -1 : std::stol(match[5]);
+		entries.push_back(LogEntry{time, match[2], match[3], std::stoi(match[4]), bytes});
+	}
+	if(skipped > 0) {
+		std::cerr << "Skipped " << skipped << " lines that aren't in Common/Combined Log Format\n";
+	}
+	return entries;
+}
@@ -0,0 +1,23 @@
+#include <string>
+#include <vector>
+
+/*
+ * Reading access logs in Common or Combined Log Format (the format of
+ * Apache's and nginx's default access logs), e.g.
+ *
+ *   127.0.0.1 - - [10/Oct/2024:13:55:36 -0700] "GET /index.html HTTP/1.1" 200 127 "-" "curl/8.0"
+ *
+ * Shared by the benchmark tools that work from real traffic.
+ */
+
+// One request from the log
+struct LogEntry {
+	double time;        // seconds since the epoch
+	std::string method;
+	std::string target;
+	int status;         // as logged
+	long bytes;         // body bytes as logged, -1 for "-"
+};
+
+double parseLogTime(const std::string &text);
+std::vector<LogEntry> readLog(const std::string &filename);
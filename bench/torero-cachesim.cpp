@@ -0,0 +1,594 @@
+/*
+ * torero-cachesim: replays an access trace against several content cache
+ * policies at several memory budgets, offline, and reports the object and
+ * byte hit ratio of each. Use it to pick the server's cache policy and
+ * CACHE_BUDGET from real traffic before changing either.
+ *
+ * The trace is an access log in Common or Combined Log Format (see
+ * AccessLog.hpp). Each successful GET is a request for the object named by
+ * its path, with the logged body size; a path logged with a different size
+ * is a new version of the file, and so a different object. Objects larger
+ * than the maximum object size (-o, the server's CACHE_MAX_OBJECT) are never
+ * cached, as in the server.
+ *
+ * Policies:
+ *   LRU        least recently used, what ContentCache does today
+ *   SLRU       segmented LRU: a probation segment, and a protected one (80%)
+ *              for objects hit at least twice
+ *   W-TinyLFU  a 1% LRU window in front of an SLRU main cache, admitting
+ *              window victims only if a count-min sketch says they are used
+ *              more often than the main cache's victim
+ *   ARC        adaptive replacement cache, balancing recency and frequency
+ *              with ghost lists (sized in bytes rather than entries)
+ *   GDSF       greedy dual size frequency, evicting the lowest
+ *              frequency / size first, so it favours small popular objects
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AccessLog.hpp"
+
+using std::cout;
+using std::string;
+using std::vector;
+
+// One request of the trace, with the object given a dense id
+struct Access {
+	int id;
+	long size;
+};
+
+/*
+ * Interface of a cache policy. The simulator only needs to know whether an
+ * access hit; on a miss the policy decides whether to admit the object and
+ * what to evict for it.
+ */
+class CachePolicy {
+	public:
+		virtual ~CachePolicy() {}
+		virtual bool access(int id, long size) = 0;
+};
+
+/*
+ * An LRU list of objects with their total size, the building block of most
+ * of the policies
+ */
+class LruList {
+	public:
+		long bytes = 0;
+
+		bool contains(int id) {
+			return where.count(id) != 0;
+		}
+		bool empty() {
+			return order.empty();
+		}
+		void pushFront(int id, long size) {
+			order.push_front({id, size});
+			where[id] = order.begin();
+			bytes += size;
+		}
+		void touch(int id) { // make most recently used
+			order.splice(order.begin(), order, where[id]);
+		}
+		long remove(int id) {
+			auto it = where[id];
+			long size = it->second;
+			bytes -= size;
+			order.erase(it);
+			where.erase(id);
+			return size;
+		}
+		std::pair<int, long> back() { // least recently used
+			return order.back();
+		}
+		std::pair<int, long> popBack() {
+			std::pair<int, long> last = order.back();
+			remove(last.first);
+			return last;
+		}
+
+	private:
+		std::list<std::pair<int, long>> order;
+		std::unordered_map<int, std::list<std::pair<int, long>>::iterator> where;
+};
+
+class Lru : public CachePolicy {
+	public:
+		Lru(long capacity) : capacity(capacity) {}
+
+		bool access(int id, long size) override {
+			if(cache.contains(id)) {
+				cache.touch(id);
+				return true;
+			}
+			if(size > capacity) {
+				return false;
+			}
+			while(cache.bytes + size > capacity) {
+				cache.popBack();
+			}
+			cache.pushFront(id, size);
+			return false;
+		}
+
+	private:
+		long capacity;
+		LruList cache;
+};
+
+/*
+ * Segmented LRU. New objects go to probation; a hit there promotes them to
+ * the protected segment, whose overflow is demoted back to probation.
+ * Victims come from probation first.
+ */
+class Slru : public CachePolicy {
+	public:
+		Slru(long capacity) : capacity(capacity), protected_capacity(capacity * 8 / 10) {}
+
+		bool access(int id, long size) override {
+			if(hit(id)) {
+				return true;
+			}
+			if(size <= capacity) {
+				makeRoom(size);
+				probation.pushFront(id, size);
+			}
+			return false;
+		}
+
+		// shared with W-TinyLFU, which uses an SLRU as its main cache
+		bool hit(int id) {
+			if(protect.contains(id)) {
+				protect.touch(id);
+				return true;
+			}
+			if(probation.contains(id)) {
+				long size = probation.remove(id);
+				protect.pushFront(id, size);
+				while(protect.bytes > protected_capacity) {
+					std::pair<int, long> demoted = protect.popBack();
+					probation.pushFront(demoted.first, demoted.second);
+				}
+				return true;
+			}
+			return false;
+		}
+		bool fits(long size) {
+			return probation.bytes + protect.bytes + size <= capacity;
+		}
+		int victim() {
+			return probation.empty() ? protect.back().first : probation.back().first;
+		}
+		void evict() {
+			if(!probation.empty()) {
+				probation.popBack();
+			}
+			else {
+				protect.popBack();
+			}
+		}
+		void makeRoom(long size) {
+			while(!fits(size)) {
+				evict();
+			}
+		}
+		void insert(int id, long size) {
+			probation.pushFront(id, size);
+		}
+		long capacity;
+
+	private:
+		long protected_capacity;
+		LruList probation;
+		LruList protect;
+};
+
+/*
+ * Count-min sketch of access frequencies with 4-bit counters, halved every
+ * sample_size accesses so old popularity fades (the TinyLFU "reset")
+ */
+class FrequencySketch {
+	public:
+		FrequencySketch(size_t expected_items) {
+			size_t width = 64;
+			while(width < expected_items) {
+				width *= 2;
+			}
+			mask = width - 1;
+			counters.assign(4 * width, 0);
+			sample_size = 10 * width;
+			additions = 0;
+		}
+
+		void increment(int id) {
+			for(int row = 0; row < 4; row++) {
+				uint8_t &counter = counters[row * (mask + 1) + index(id, row)];
+				if(counter < 15) {
+					counter++;
+				}
+			}
+			if(++additions >= sample_size) {
+				for(uint8_t &counter : counters) {
+					counter /= 2;
+				}
+				additions /= 2;
+			}
+		}
+
+		int estimate(int id) {
+			int minimum = 15;
+			for(int row = 0; row < 4; row++) {
+				minimum = std::min(minimum, (int) counters[row * (mask + 1) + index(id, row)]);
+			}
+			return minimum;
+		}
+
+	private:
+		vector<uint8_t> counters;
+		size_t mask;
+		size_t sample_size;
+		size_t additions;
+
+		size_t index(int id, int row) {
+			static const uint64_t seeds[4] = {
+				0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0x27d4eb2f165667c5ULL
+			};
+			uint64_t hash = ((uint64_t) id + 1) * seeds[row];
+			hash ^= hash >> 32;
+			return hash & mask;
+		}
+};
+
+/*
+ * W-TinyLFU: an LRU window of 1% of the budget takes every new object; what
+ * falls out of it competes with the main SLRU's victim on estimated
+ * frequency, and only the more frequent of the two stays.
+ */
+class WTinyLfu : public CachePolicy {
+	public:
+		WTinyLfu(long capacity, size_t expected_items) : window_capacity(std::max(1L, capacity / 100)),
+			main(capacity - window_capacity), sketch(expected_items) {}
+
+		bool access(int id, long size) override {
+			sketch.increment(id);
+			if(window.contains(id)) {
+				window.touch(id);
+				return true;
+			}
+			if(main.hit(id)) {
+				return true;
+			}
+
+			if(size <= window_capacity) {
+				window.pushFront(id, size);
+			}
+			else {
+				admit(id, size); // too big for the window, competes directly
+			}
+			while(window.bytes > window_capacity) {
+				std::pair<int, long> candidate = window.popBack();
+				admit(candidate.first, candidate.second);
+			}
+			return false;
+		}
+
+	private:
+		long window_capacity;
+		LruList window;
+		Slru main;
+		FrequencySketch sketch;
+
+		void admit(int id, long size) {
+			if(size > main.capacity) {
+				return;
+			}
+			// evict main victims for as long as the candidate beats them
+			while(!main.fits(size)) {
+				if(sketch.estimate(id) <= sketch.estimate(main.victim())) {
+					return; // rejected
+				}
+				main.evict();
+			}
+			main.insert(id, size);
+		}
+};
+
+/*
+ * ARC with sizes: T1 holds objects seen once recently, T2 objects seen at
+ * least twice, and the ghost lists B1 and B2 remember (without data) what
+ * was evicted from each. A hit in a ghost list moves the target size of T1
+ * (in bytes) towards the list that would have kept the object.
+ */
+class Arc : public CachePolicy {
+	public:
+		Arc(long capacity) : capacity(capacity), target(0) {}
+
+		bool access(int id, long size) override {
+			if(t1.contains(id)) {
+				t1.remove(id);
+				t2.pushFront(id, size);
+				return true;
+			}
+			if(t2.contains(id)) {
+				t2.touch(id);
+				return true;
+			}
+			if(size > capacity) {
+				return false;
+			}
+
+			if(b1.contains(id)) { // recency would have kept it, grow T1
+				long delta = std::max(1L, b2.bytes / std::max(1L, b1.bytes)) * size;
+				target = std::min(capacity, target + delta);
+				b1.remove(id);
+				makeRoom(size, false); // replaces only while the cache is full
+				t2.pushFront(id, size);
+				return false;
+			}
+			if(b2.contains(id)) { // frequency would have kept it, shrink T1
+				long delta = std::max(1L, b1.bytes / std::max(1L, b2.bytes)) * size;
+				target = std::max(0L, target - delta);
+				b2.remove(id);
+				makeRoom(size, true);
+				t2.pushFront(id, size);
+				return false;
+			}
+
+			// a new object: keep the ghost lists to at most the budget each
+			while(t1.bytes + b1.bytes + size > capacity && !b1.empty()) {
+				b1.popBack();
+			}
+			while(t1.bytes + t2.bytes + b1.bytes + b2.bytes + size > 2 * capacity && !b2.empty()) {
+				b2.popBack();
+			}
+			makeRoom(size, false);
+			t1.pushFront(id, size);
+			return false;
+		}
+
+	private:
+		long capacity;
+		long target; // bytes of T1 aimed for
+		LruList t1, t2, b1, b2;
+
+		void makeRoom(long size, bool in_b2) {
+			while(t1.bytes + t2.bytes + size > capacity) {
+				replace(in_b2);
+			}
+		}
+
+		void replace(bool in_b2) {
+			bool from_t1 = !t1.empty() && (t1.bytes > target || (in_b2 && t1.bytes == target) || t2.empty());
+			if(from_t1) {
+				std::pair<int, long> victim = t1.popBack();
+				b1.pushFront(victim.first, victim.second);
+			}
+			else if(!t2.empty()) {
+				std::pair<int, long> victim = t2.popBack();
+				b2.pushFront(victim.first, victim.second);
+			}
+		}
+};
+
+/*
+ * GreedyDual-Size-Frequency with a cost of 1 per miss: each object's
+ * priority is L + frequency / size, the lowest goes first, and L rises to the
+ * priority of each evicted object so long-idle objects age out.
+ */
+class Gdsf : public CachePolicy {
+	public:
+		Gdsf(long capacity) : capacity(capacity), clock(0), used(0) {}
+
+		bool access(int id, long size) override {
+			auto found = entries.find(id);
+			if(found != entries.end()) {
+				Entry &entry = found->second;
+				queue.erase({entry.priority, id});
+				entry.frequency++;
+				entry.priority = clock + (double) entry.frequency / entry.size;
+				queue.insert({entry.priority, id});
+				return true;
+			}
+			if(size > capacity) {
+				return false;
+			}
+
+			while(used + size > capacity) {
+				std::pair<double, int> lowest = *queue.begin();
+				queue.erase(queue.begin());
+				clock = lowest.first;
+				used -= entries[lowest.second].size;
+				entries.erase(lowest.second);
+			}
+			double priority = clock + 1.0 / size;
+			entries[id] = Entry{size, 1, priority};
+			queue.insert({priority, id});
+			used += size;
+			return false;
+		}
+
+	private:
+		struct Entry {
+			long size;
+			long frequency;
+			double priority;
+		};
+		long capacity;
+		double clock;
+		long used;
+		std::unordered_map<int, Entry> entries;
+		std::set<std::pair<double, int>> queue;
+};
+
+/**
+ * Parse a byte count with an optional K, M or G suffix
+ *
+ * @param text E.g. "64M"
+ * @returns The number of bytes
+ */
+long parseBytes(const string &text) {
+	char *end;
+	double value = strtod(text.c_str(), &end);
+	switch(*end) {
+		case 'k': case 'K': value *= 1024; break;
+		case 'm': case 'M': value *= 1024 * 1024; break;
+		case 'g': case 'G': value *= 1024.0 * 1024 * 1024; break;
+	}
+	return (long) value;
+}
+
+/**
+ * Format a byte count for the report
+ *
+ * @param bytes The count
+ * @returns E.g. "64M"
+ */
+string formatBytes(long bytes) {
+	const char *units[] = {"", "K", "M", "G", "T"};
+	int unit = 0;
+	double value = bytes;
+	while(value >= 1024 && unit < 4) {
+		value /= 1024;
+		unit++;
+	}
+	char text[32];
+	snprintf(text, sizeof(text), value == (long) value ? "%.0f%s" : "%.1f%s", value, units[unit]);
+	return text;
+}
+
+/**
+ * Make a policy by name
+ *
+ * @param name One of the names printed in the report
+ * @param capacity Budget in bytes
+ * @param distinct Number of distinct objects in the trace
+ * @returns The policy
+ */
+std::unique_ptr<CachePolicy> makePolicy(const string &name, long capacity, size_t distinct) {
+	if(name == "LRU") return std::unique_ptr<CachePolicy>(new Lru(capacity));
+	if(name == "SLRU") return std::unique_ptr<CachePolicy>(new Slru(capacity));
+	if(name == "W-TinyLFU") return std::unique_ptr<CachePolicy>(new WTinyLfu(capacity, distinct));
+	if(name == "ARC") return std::unique_ptr<CachePolicy>(new Arc(capacity));
+	if(name == "GDSF") return std::unique_ptr<CachePolicy>(new Gdsf(capacity));
+	return nullptr;
+}
+
+void usage(const char *program) {
+	cout << "Usage: " << program << " [options] access_log\n";
+	cout << "  -b budgets  comma separated cache budgets (default 4M,16M,64M,256M)\n";
+	cout << "  -o bytes    largest object that may be cached (default 1M, as the server)\n";
+	cout << "  -p names    policies to run (default LRU,SLRU,W-TinyLFU,ARC,GDSF)\n";
+	cout << "  -w count    warm-up requests not counted in the ratios (default 0)\n";
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	string budget_list = "4M,16M,64M,256M";
+	long max_object = 1024 * 1024;
+	string policy_list = "LRU,SLRU,W-TinyLFU,ARC,GDSF";
+	size_t warmup = 0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "b:o:p:w:")) != -1) {
+		switch(opt) {
+			case 'b': budget_list = optarg; break;
+			case 'o': max_object = parseBytes(optarg); break;
+			case 'p': policy_list = optarg; break;
+			case 'w': warmup = strtoul(optarg, nullptr, 10); break;
+			default: usage(argv[0]);
+		}
+	}
+	if(argc - optind != 1) {
+		usage(argv[0]);
+	}
+
+	vector<long> budgets;
+	vector<string> policies;
+	std::istringstream budget_items(budget_list), policy_items(policy_list);
+	string item;
+	while(getline(budget_items, item, ',')) {
+		budgets.push_back(parseBytes(item));
+	}
+	while(getline(policy_items, item, ',')) {
+		if(!makePolicy(item, 1, 1)) {
+			std::cerr << "Unknown policy " << item << "\n";
+			exit(1);
+		}
+		policies.push_back(item);
+	}
+
+	// turn the log into (object id, size) accesses
+	vector<Access> trace;
+	std::map<std::pair<string, long>, int> ids;
+	for(const LogEntry &entry : readLog(argv[optind])) {
+		if(entry.method != "GET" || entry.status != 200 || entry.bytes < 0) {
+			continue;
+		}
+		string path = entry.target.substr(0, entry.target.find('?'));
+		auto inserted = ids.insert({{path, entry.bytes}, (int) ids.size()});
+		trace.push_back(Access{inserted.first->second, entry.bytes});
+	}
+	if(trace.size() <= warmup) {
+		std::cerr << "No requests to simulate\n";
+		exit(1);
+	}
+
+	// the best any cache could do: every object misses only the first time
+	long total_requests = 0, total_bytes = 0, cold_requests = 0, cold_bytes = 0;
+	vector<bool> seen(ids.size(), false);
+	for(size_t i = 0; i < trace.size(); i++) {
+		bool first = !seen[trace[i].id];
+		seen[trace[i].id] = true;
+		if(i < warmup) {
+			continue;
+		}
+		total_requests++;
+		total_bytes += trace[i].size;
+		if(first || trace[i].size > max_object) {
+			cold_requests++;
+			cold_bytes += trace[i].size;
+		}
+	}
+
+	printf("%zu requests for %zu objects (%s), %zu warm-up\n", trace.size(), ids.size(),
+			formatBytes(total_bytes).c_str(), warmup);
+	printf("ceiling (infinite cache): %.2f%% object, %.2f%% byte hit ratio\n\n",
+			100.0 * (total_requests - cold_requests) / total_requests,
+			100.0 * (total_bytes - cold_bytes) / total_bytes);
+	printf("%-10s %8s %12s %12s\n", "policy", "budget", "object hits", "byte hits");
+
+	for(long budget : budgets) {
+		for(const string &name : policies) {
+			std::unique_ptr<CachePolicy> policy = makePolicy(name, budget, ids.size());
+			long hits = 0, hit_bytes = 0;
+			for(size_t i = 0; i < trace.size(); i++) {
+				bool hit = trace[i].size <= max_object && policy->access(trace[i].id, trace[i].size);
+				if(hit && i >= warmup) {
+					hits++;
+					hit_bytes += trace[i].size;
+				}
+			}
+			printf("%-10s %8s %11.2f%% %11.2f%%\n", name.c_str(), formatBytes(budget).c_str(),
+					100.0 * hits / total_requests, 100.0 * hit_bytes / total_bytes);
+		}
+		printf("\n");
+	}
+	return 0;
+}
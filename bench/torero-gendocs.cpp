@@ -0,0 +1,417 @@
+/*
+ * torero-gendocs: builds a synthetic document root for scaling benchmarks,
+ * from a handful of files (like WWW/) up to millions, without having to
+ * check any of it in.
+ *
+ * Files are spread over a directory tree of a given fan-out and depth, with
+ * sizes drawn from a lognormal or Pareto distribution and types drawn from a
+ * MIME mix. HTML pages link to some of the generated stylesheets and images,
+ * so the server's prefetcher and early hints have something to do. The same
+ * seed always gives the same tree.
+ *
+ * Optionally an access log (Common Log Format) of requests for the generated
+ * files is written too, with Zipf-distributed popularity and Poisson
+ * arrivals, for torero-replay and the cache simulator.
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::cout;
+using std::string;
+using std::vector;
+
+// A distribution of file sizes, from the -s option
+struct SizeDistribution {
+	string kind;   // "lognormal", "pareto" or "fixed"
+	double a;      // lognormal mu, Pareto minimum, fixed size
+	double b;      // lognormal sigma, Pareto alpha
+};
+
+// One file type of the MIME mix, from the -m option
+struct FileType {
+	string extension;
+	double weight;
+};
+
+// One generated file
+struct GeneratedFile {
+	string path;   // URL path, e.g. "/d03/d01/f0000042.html"
+	string extension;
+	long size;
+};
+
+/**
+ * Parse a size distribution such as "lognormal:9,1.5", "pareto:4096,1.2" or
+ * "fixed:1024"
+ *
+ * @param text The option value
+ * @returns The distribution; exits with a message if it is malformed
+ */
+SizeDistribution parseDistribution(const string &text) {
+	SizeDistribution dist{"", 0, 0};
+	size_t colon = text.find(':');
+	dist.kind = text.substr(0, colon);
+	if(colon != string::npos) {
+		sscanf(text.c_str() + colon + 1, "%lf,%lf", &dist.a, &dist.b);
+	}
+
+	bool valid = (dist.kind == "lognormal" && dist.b > 0)
+		|| (dist.kind == "pareto" && dist.a > 0 && dist.b > 0)
+		|| (dist.kind == "fixed" && dist.a >= 0);
+	if(!valid) {
+		std::cerr << "Bad size distribution \"" << text << "\"; use lognormal:mu,sigma, "
+			<< "pareto:min,alpha or fixed:bytes\n";
+		exit(1);
+	}
+	return dist;
+}
+
+/**
+ * Parse a MIME mix such as "html=30,css=10,png=30,pdf=5,txt=25"
+ *
+ * @param text The option value
+ * @returns The file types with their weights; exits if none are valid
+ */
+vector<FileType> parseMix(const string &text) {
+	vector<FileType> mix;
+	std::istringstream items(text);
+	string item;
+	while(getline(items, item, ',')) {
+		size_t equals = item.find('=');
+		if(equals == string::npos) {
+			continue;
+		}
+		double weight = atof(item.c_str() + equals + 1);
+		if(weight > 0) {
+			mix.push_back(FileType{item.substr(0, equals), weight});
+		}
+	}
+	if(mix.empty()) {
+		std::cerr << "Bad MIME mix \"" << text << "\"; use e.g. html=30,css=10,png=60\n";
+		exit(1);
+	}
+	return mix;
+}
+
+/**
+ * Make a directory, and its parents, if it doesn't exist yet
+ *
+ * @param path The directory
+ */
+void makeDirectory(const string &path) {
+	for(size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+		string prefix = path.substr(0, slash);
+		if(mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+			perror(("Creating " + prefix + " failed").c_str());
+			exit(1);
+		}
+		if(slash == string::npos) {
+			return;
+		}
+	}
+}
+
+/**
+ * List the directories of a tree, parents before children
+ *
+ * @param fanout Subdirectories per directory
+ * @param depth Levels of subdirectories below the root
+ * @returns Their paths relative to the root, starting with "" for the root
+ */
+vector<string> directoryTree(int fanout, int depth) {
+	vector<string> dirs = {""};
+	size_t level_start = 0;
+	for(int level = 0; level < depth; level++) {
+		size_t level_end = dirs.size();
+		for(size_t i = level_start; i < level_end; i++) {
+			for(int child = 0; child < fanout; child++) {
+				char name[16];
+				snprintf(name, sizeof(name), "/d%02d", child);
+				dirs.push_back(dirs[i] + name);
+			}
+		}
+		level_start = level_end;
+	}
+	return dirs;
+}
+
+/**
+ * Build the body of an HTML page of about the given size, linking to some
+ * of the stylesheets and images
+ *
+ * @param size Size to pad the page to
+ * @param assets Paths of generated stylesheets and images
+ * @param rng Random number generator
+ * @returns The page
+ */
+string htmlPage(long size, const vector<const GeneratedFile *> &assets, std::mt19937_64 &rng) {
+	std::stringstream page;
+	page << "<html>\n<head>\n<title>generated</title>\n";
+	vector<string> images;
+	for(int i = 0; i < 3 && !assets.empty(); i++) {
+		const GeneratedFile *asset = assets[rng() % assets.size()];
+		if(asset->extension == "css") {
+			page << "<link rel=\"stylesheet\" href=\"" << asset->path << "\">\n";
+		}
+		else {
+			images.push_back(asset->path);
+		}
+	}
+	page << "</head>\n<body>\n";
+	for(const string &image : images) {
+		page << "<img src=\"" << image << "\">\n";
+	}
+
+	string text = page.str();
+	string end = "</body>\n</html>\n";
+	long padding = size - (long) (text.length() + end.length());
+	if(padding > 0) {
+		text.append(padding, 'x');
+	}
+	return text + end;
+}
+
+/**
+ * Write one file of the tree
+ *
+ * @param root The document root
+ * @param file The file
+ * @param contents Its contents, or "" to fill it with a byte pattern
+ * @param sparse Create files as holes (ftruncate) instead of writing data
+ */
+void writeFile(const string &root, const GeneratedFile &file, const string &contents, bool sparse) {
+	string path = root + file.path;
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0) {
+		perror(("Creating " + path + " failed").c_str());
+		exit(1);
+	}
+
+	if(!contents.empty()) {
+		if(write(fd, contents.data(), contents.length()) != (ssize_t) contents.length()) {
+			perror(("Writing " + path + " failed").c_str());
+			exit(1);
+		}
+	}
+	else if(sparse) {
+		if(ftruncate(fd, file.size) != 0) {
+			perror(("Sizing " + path + " failed").c_str());
+			exit(1);
+		}
+	}
+	else {
+		static const string pattern = [] {
+			string block(65536, '\0');
+			for(size_t i = 0; i < block.size(); i++) {
+				block[i] = "0123456789abcdef\n"[i % 17];
+			}
+			return block;
+		}();
+		for(long written = 0; written < file.size; ) {
+			size_t chunk = std::min((long) pattern.size(), file.size - written);
+			ssize_t bytes = write(fd, pattern.data(), chunk);
+			if(bytes <= 0) {
+				perror(("Writing " + path + " failed").c_str());
+				exit(1);
+			}
+			written += bytes;
+		}
+	}
+	close(fd);
+}
+
+/**
+ * Write an access log of requests for the generated files
+ *
+ * @param filename Where to write it
+ * @param files The generated files
+ * @param requests Number of requests
+ * @param zipf_s Zipf exponent of the popularity of files
+ * @param rate Mean requests per second
+ * @param rng Random number generator
+ */
+void writeAccessLog(const string &filename, const vector<GeneratedFile> &files, long requests,
+		double zipf_s, double rate, std::mt19937_64 &rng) {
+	// popularity rank -> file, shuffled so popularity isn't tied to the tree
+	vector<size_t> by_rank(files.size());
+	for(size_t i = 0; i < by_rank.size(); i++) {
+		by_rank[i] = i;
+	}
+	std::shuffle(by_rank.begin(), by_rank.end(), rng);
+
+	// cumulative weights of the ranks, for sampling by binary search
+	vector<double> cdf(files.size());
+	double total = 0;
+	for(size_t rank = 0; rank < files.size(); rank++) {
+		total += 1.0 / pow(rank + 1, zipf_s);
+		cdf[rank] = total;
+	}
+
+	std::ofstream log(filename);
+	if(!log.is_open()) {
+		perror(("Creating " + filename + " failed").c_str());
+		exit(1);
+	}
+	std::uniform_real_distribution<double> uniform(0, total);
+	std::exponential_distribution<double> gap(rate);
+	double now = time(nullptr);
+	for(long i = 0; i < requests; i++) {
+		size_t rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+		const GeneratedFile &file = files[by_rank[std::min(rank, files.size() - 1)]];
+		now += gap(rng);
+
+		time_t seconds = (time_t) now;
+		struct tm tm;
+		gmtime_r(&seconds, &tm);
+		char stamp[64];
+		strftime(stamp, sizeof(stamp), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+		log << "127.0.0.1 - - [" << stamp << "] \"GET " << file.path << " HTTP/1.1\" 200 "
+			<< file.size << "\n";
+	}
+}
+
+void usage(const char *program) {
+	cout << "Usage: " << program << " [options] output_dir\n";
+	cout << "  -n count   number of files (default 1000)\n";
+	cout << "  -f fanout  subdirectories per directory (default 10)\n";
+	cout << "  -d depth   levels of subdirectories (default 2)\n";
+	cout << "  -s dist    file sizes: lognormal:mu,sigma, pareto:min,alpha or fixed:bytes\n";
+	cout << "             (default lognormal:9,1.5, a median of about 8 KB)\n";
+	cout << "  -M bytes   largest file size (default 1073741824)\n";
+	cout << "  -m mix     MIME mix by extension (default html=20,css=5,png=25,jpg=25,gif=5,pdf=5,txt=15)\n";
+	cout << "  -x         create files as holes instead of writing data (except HTML)\n";
+	cout << "  -a count   also write count requests to output_dir.log (Common Log Format)\n";
+	cout << "  -z s       Zipf exponent of file popularity in the log (default 1.0)\n";
+	cout << "  -r rate    mean requests per second in the log (default 100)\n";
+	cout << "  -S seed    random seed (default 1)\n";
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	long num_files = 1000;
+	int fanout = 10;
+	int depth = 2;
+	SizeDistribution dist = parseDistribution("lognormal:9,1.5");
+	long max_size = 1L << 30;
+	vector<FileType> mix = parseMix("html=20,css=5,png=25,jpg=25,gif=5,pdf=5,txt=15");
+	bool sparse = false;
+	long log_requests = 0;
+	double zipf_s = 1.0;
+	double rate = 100;
+	unsigned long seed = 1;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:f:d:s:M:m:xa:z:r:S:")) != -1) {
+		switch(opt) {
+			case 'n': num_files = atol(optarg); break;
+			case 'f': fanout = std::max(1, atoi(optarg)); break;
+			case 'd': depth = std::max(0, atoi(optarg)); break;
+			case 's': dist = parseDistribution(optarg); break;
+			case 'M': max_size = std::max(1L, atol(optarg)); break;
+			case 'm': mix = parseMix(optarg); break;
+			case 'x': sparse = true; break;
+			case 'a': log_requests = atol(optarg); break;
+			case 'z': zipf_s = atof(optarg); break;
+			case 'r': rate = std::max(0.001, atof(optarg)); break;
+			case 'S': seed = strtoul(optarg, nullptr, 10); break;
+			default: usage(argv[0]);
+		}
+	}
+	if(argc - optind != 1 || num_files < 1) {
+		usage(argv[0]);
+	}
+	string root = argv[optind];
+	while(root.length() > 1 && root.back() == '/') {
+		root.pop_back();
+	}
+
+	std::mt19937_64 rng(seed);
+
+	vector<string> dirs = directoryTree(fanout, depth);
+	for(const string &dir : dirs) {
+		makeDirectory(root + dir);
+	}
+
+	// draw every file's type and size first, so pages can link to assets
+	// that come after them
+	std::lognormal_distribution<double> lognormal(dist.a, dist.b > 0 ? dist.b : 1);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	vector<double> weights;
+	for(const FileType &type : mix) {
+		weights.push_back(type.weight);
+	}
+	std::discrete_distribution<size_t> pick_type(weights.begin(), weights.end());
+
+	vector<GeneratedFile> files;
+	files.reserve(num_files);
+	vector<const GeneratedFile *> assets;
+	for(long i = 0; i < num_files; i++) {
+		double size;
+		if(dist.kind == "lognormal") {
+			size = lognormal(rng);
+		}
+		else if(dist.kind == "pareto") { // inverse transform sampling
+			size = dist.a / pow(1 - uniform(rng), 1 / dist.b);
+		}
+		else {
+			size = dist.a;
+		}
+
+		const string &extension = mix[pick_type(rng)].extension;
+		char name[32];
+		snprintf(name, sizeof(name), "/f%08ld.", i);
+		string path = dirs[i % dirs.size()] + name + extension;
+		files.push_back(GeneratedFile{path, extension, std::min(max_size, std::max(1L, (long) size))});
+	}
+	for(const GeneratedFile &file : files) {
+		if(file.extension == "css" || file.extension == "png" || file.extension == "jpg"
+				|| file.extension == "gif") {
+			assets.push_back(&file);
+		}
+	}
+
+	long total_bytes = 0;
+	for(GeneratedFile &file : files) {
+		string contents;
+		if(file.extension == "html" || file.extension == "htm") {
+			contents = htmlPage(file.size, assets, rng);
+			file.size = contents.length(); // links can push it past its drawn size
+		}
+		writeFile(root, file, contents, sparse);
+		total_bytes += file.size;
+	}
+
+	vector<long> sizes;
+	for(const GeneratedFile &file : files) {
+		sizes.push_back(file.size);
+	}
+	std::sort(sizes.begin(), sizes.end());
+	cout << "Wrote " << files.size() << " files in " << dirs.size() << " directories under "
+		<< root << ", " << total_bytes << " bytes" << (sparse ? " (sparse)" : "") << "\n";
+	cout << "file size: min " << sizes.front() << "  p50 " << sizes[sizes.size() / 2]
+		<< "  p90 " << sizes[sizes.size() * 9 / 10] << "  p99 " << sizes[sizes.size() * 99 / 100]
+		<< "  max " << sizes.back() << "\n";
+
+	if(log_requests > 0) {
+		writeAccessLog(root + ".log", files, log_requests, zipf_s, rate, rng);
+		cout << "Wrote " << log_requests << " requests to " << root << ".log\n";
+	}
+	return 0;
+}
@@ -0,0 +1,313 @@
+/*
+ * torero-replay: replays the requests of an access log against a running
+ * ToreroServe, to benchmark it with a real mix of paths instead of a single
+ * URL.
+ *
+ * The log is read in Common or Combined Log Format (the format of Apache's
+ * and nginx's default access logs), e.g.
+ *
+ *   127.0.0.1 - - [10/Oct/2024:13:55:36 -0700] "GET /index.html HTTP/1.1" 200 127 "-" "curl/8.0"
+ *
+ * Requests are sent at the same times relative to the first one as in the
+ * log, sped up or slowed down with -s (or as fast as possible with -s 0), by
+ * a pool of client threads that each open one connection per request. At
+ * the end the tool prints the latency distribution and how the statuses and
+ * body sizes the server sent differ from those in the log.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AccessLog.hpp"
+
+using std::cout;
+using std::string;
+using std::vector;
+using std::thread;
+
+using Clock = std::chrono::steady_clock;
+
+// What replaying one request got back
+struct Result {
+	double latency_us; // connect to last byte
+	double lag_us;     // how late it was sent compared to its schedule
+	int status;        // 0 if the request failed
+	long bytes;        // body bytes received
+};
+
+/**
+ * Send one request on a new connection and read the whole response
+ *
+ * @param addr Address of the server
+ * @param entry The request
+ * @param result Gets the status and body size received
+ * @returns When the last byte was received (or the request failed), so the
+ * parsing done here isn't timed
+ */
+Clock::time_point replayOne(const struct addrinfo *addr, const LogEntry &entry, Result &result) {
+	result.status = 0;
+	result.bytes = 0;
+
+	int sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+	if(sock < 0) {
+		return Clock::now();
+	}
+	if(connect(sock, addr->ai_addr, addr->ai_addrlen) != 0) {
+		close(sock);
+		return Clock::now();
+	}
+
+	string request = entry.method + " " + entry.target + " HTTP/1.0\r\n"
+		+ "Host: localhost\r\n"
+		+ "User-Agent: torero-replay\r\n\r\n";
+	if(send(sock, request.c_str(), request.length(), MSG_NOSIGNAL) != (ssize_t) request.length()) {
+		close(sock);
+		return Clock::now();
+	}
+
+	// read until the server closes the connection
+	string response;
+	char buffer[65536];
+	ssize_t bytes;
+	while((bytes = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+		response.append(buffer, bytes);
+	}
+	Clock::time_point done = Clock::now();
+	close(sock);
+
+	// skip any 1xx responses (e.g. 103 Early Hints) before the final one
+	size_t start = 0;
+	while(response.compare(start, 10, "HTTP/1.1 1") == 0 || response.compare(start, 10, "HTTP/1.0 1") == 0) {
+		size_t end = response.find("\r\n\r\n", start);
+		if(end == string::npos) {
+			return done;
+		}
+		start = end + 4;
+	}
+
+	size_t header_end = response.find("\r\n\r\n", start);
+	if(response.compare(start, 5, "HTTP/") != 0 || header_end == string::npos) {
+		return done;
+	}
+	result.status = atoi(response.c_str() + response.find(' ', start) + 1);
+
+	// the body is everything received after the headers, but no more than
+	// Content-Length says (the server ends it with an extra CRLF), so a
+	// transfer cut short shows up as a size difference
+	static const std::regex length_regex("\r\nContent-Length: *(\\d+)", std::regex::icase);
+	std::smatch match;
+	string headers = response.substr(start, header_end - start);
+	result.bytes = response.length() - (header_end + 4);
+	if(std::regex_search(headers, match, length_regex)) {
+		result.bytes = std::min(result.bytes, std::stol(match[1]));
+	}
+	return done;
+}
+
+/**
+ * Client thread: take the next request, wait for its time, and replay it
+ *
+ * @param addr Address of the server
+ * @param entries The requests
+ * @param results One result per request, filled in here
+ * @param next Index of the next request to take, shared by the threads
+ * @param start When the replay started
+ * @param speed How many times faster than the log to replay, 0 for no waits
+ */
+void client(const struct addrinfo *addr, const vector<LogEntry> &entries, vector<Result> &results,
+		std::atomic<size_t> &next, Clock::time_point start, double speed) {
+	while(true) {
+		size_t i = next++;
+		if(i >= entries.size()) {
+			return;
+		}
+
+		Clock::time_point due = start;
+		if(speed > 0) {
+			double offset = (entries[i].time - entries[0].time) / speed;
+			due += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(offset));
+			std::this_thread::sleep_until(due);
+		}
+
+		Clock::time_point sent = Clock::now();
+		Clock::time_point done = replayOne(addr, entries[i], results[i]);
+
+		results[i].latency_us = std::chrono::duration<double, std::micro>(done - sent).count();
+		results[i].lag_us = (speed > 0) ? std::chrono::duration<double, std::micro>(sent - due).count() : 0;
+	}
+}
+
+/**
+ * Value at a percentile of sorted values
+ *
+ * @param sorted Values in ascending order (not empty)
+ * @param percent Percentile, 0 to 100
+ * @returns The value
+ */
+double percentile(const vector<double> &sorted, double percent) {
+	size_t index = (size_t) (percent / 100 * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void usage(const char *program) {
+	cout << "Usage: " << program << " [options] host port access_log\n";
+	cout << "  -c count   client threads, each with one connection at a time (default 64)\n";
+	cout << "  -s speed   replay this many times faster than logged, 0 for no waits (default 1)\n";
+	cout << "  -n count   replay only the first count requests\n";
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	int num_clients = 64;
+	double speed = 1;
+	size_t limit = 0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "c:s:n:")) != -1) {
+		switch(opt) {
+			case 'c':
+				num_clients = std::max(1, atoi(optarg));
+				break;
+			case 's':
+				speed = atof(optarg);
+				break;
+			case 'n':
+				limit = strtoul(optarg, nullptr, 10);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if(argc - optind != 3) {
+		usage(argv[0]);
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *addr;
+	int error = getaddrinfo(argv[optind], argv[optind + 1], &hints, &addr);
+	if(error != 0) {
+		std::cerr << "Resolving " << argv[optind] << " failed: " << gai_strerror(error) << "\n";
+		exit(1);
+	}
+
+	vector<LogEntry> entries = readLog(argv[optind + 2]);
+	if(limit > 0 && entries.size() > limit) {
+		entries.resize(limit);
+	}
+	if(entries.empty()) {
+		std::cerr << "No requests to replay\n";
+		exit(1);
+	}
+	// logs are written when requests finish, so they can be slightly out of order
+	std::stable_sort(entries.begin(), entries.end(),
+			[](const LogEntry &a, const LogEntry &b) { return a.time < b.time; });
+
+	double span = entries.back().time - entries.front().time;
+	cout << "Replaying " << entries.size() << " requests spanning " << span << " s";
+	if(speed > 0) {
+		cout << " at " << speed << "x (" << span / speed << " s)";
+	}
+	cout << " with " << num_clients << " clients\n";
+
+	vector<Result> results(entries.size());
+	std::atomic<size_t> next(0);
+	Clock::time_point start = Clock::now();
+	vector<thread> clients;
+	for(int i = 0; i < num_clients; i++) {
+		clients.push_back(thread(client, addr, std::cref(entries), std::ref(results), std::ref(next), start, speed));
+	}
+	for(thread &t : clients) {
+		t.join();
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	freeaddrinfo(addr);
+
+	// latency distribution
+	vector<double> latencies;
+	double max_lag = 0;
+	size_t failed = 0;
+	for(const Result &result : results) {
+		latencies.push_back(result.latency_us);
+		max_lag = std::max(max_lag, result.lag_us);
+		if(result.status == 0) {
+			failed++;
+		}
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	printf("\n%zu requests in %.2f s (%.0f req/s), %zu failed\n", results.size(), elapsed,
+			results.size() / elapsed, failed);
+	printf("latency (us): p50 %.0f  p90 %.0f  p99 %.0f  p99.9 %.0f  max %.0f\n",
+			percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+			percentile(latencies, 99.9), latencies.back());
+	if(speed > 0) {
+		printf("sent up to %.0f us behind schedule (raise -c if this is large)\n", max_lag);
+	}
+
+	// differences from the log: status pairs, and sizes where statuses agree
+	std::map<std::pair<int, int>, size_t> status_diffs;
+	std::map<string, size_t> byte_diffs;
+	size_t too_many = 0;
+	for(size_t i = 0; i < results.size(); i++) {
+		if(results[i].status != entries[i].status) {
+			status_diffs[{entries[i].status, results[i].status}]++;
+			too_many += (results[i].status == 429);
+		}
+		else if(entries[i].bytes >= 0 && results[i].bytes != entries[i].bytes) {
+			byte_diffs[entries[i].target]++;
+		}
+	}
+
+	if(status_diffs.empty()) {
+		printf("\nall statuses match the log\n");
+	}
+	else {
+		printf("\nstatus differences (logged -> received, 0 = failed):\n");
+		for(const auto &diff : status_diffs) {
+			printf("  %d -> %d: %zu\n", diff.first.first, diff.first.second, diff.second);
+		}
+	}
+	if(too_many > 0) {
+		// every client thread connects from the same address
+		printf("warning: %zu requests got 429 Too Many Requests; start torero-serve with -c 0 "
+				"so its per-client connection limit doesn't apply\n", too_many);
+	}
+
+	if(byte_diffs.empty()) {
+		printf("all body sizes match the log\n");
+	}
+	else {
+		// show the paths that differ most often
+		vector<std::pair<size_t, string>> worst;
+		size_t total = 0;
+		for(const auto &diff : byte_diffs) {
+			worst.push_back({diff.second, diff.first});
+			total += diff.second;
+		}
+		std::sort(worst.rbegin(), worst.rend());
+		printf("body size differs for %zu requests to %zu paths, e.g.:\n", total, worst.size());
+		for(size_t i = 0; i < worst.size() && i < 10; i++) {
+			printf("  %s: %zu\n", worst[i].second.c_str(), worst[i].first);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,625 @@
+/*
+ * torero-sendbench: sends the same files over loopback with each of the ways
+ * a server can send a response body, to choose the server's strategy for
+ * each file size from measurements rather than folklore.
+ *
+ * Strategies:
+ *   stream-4k     std::ifstream read into a 4 KB buffer, then send(); the
+ *                 server's original sendFile() loop
+ *   read-64k      read() and send() with a 64 KB buffer
+ *   read-1m       read() and send() with a 1 MB buffer
+ *   memory        one send() of contents already in memory; what the
+ *                 server does for files in its content cache
+ *   sendfile      sendfile() in 256 KB slices, as the server's bulk lane
+ *   mmap-writev   mmap() the file and writev() the header and body together
+ *   splice        splice() from the file into a pipe and from it to the
+ *                 socket, with one pipe kept for all requests
+ *   io_uring      a linked read and send per 256 KB, four chunks per
+ *                 io_uring_enter(), with one ring kept for all requests
+ *
+ * Each request is a new connection that gets a small HTTP header and then
+ * the body, which a receiver thread reads and discards. For every file size
+ * and strategy the tool reports throughput, CPU time of the sending thread
+ * per GB, and system calls per request. Connecting and closing are the same
+ * for all strategies and are not counted.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cout;
+using std::string;
+using std::vector;
+
+using Clock = std::chrono::steady_clock;
+
+const long SLICE = 256 * 1024; // sendfile() slice and io_uring chunk, as STREAM_SLICE in the server
+const int URING_CHUNKS = 4;    // chunks linked into one io_uring submission
+
+// system calls made by the strategy being measured
+static long syscalls = 0;
+
+/**
+ * Count a system call and pass its result through
+ *
+ * @param result What the call returned
+ * @returns The same
+ */
+template<typename T> T counted(T result) {
+	syscalls++;
+	return result;
+}
+
+/**
+ * Exit with the message for errno
+ *
+ * @param what The call that failed
+ */
+void fail(const char *what) {
+	perror(what);
+	exit(1);
+}
+
+/**
+ * Send a whole buffer on a blocking socket
+ *
+ * @param sock The socket
+ * @param data What to send
+ * @param length Bytes to send
+ */
+void sendAll(int sock, const char *data, size_t length) {
+	while(length > 0) {
+		ssize_t bytes = counted(send(sock, data, length, MSG_NOSIGNAL));
+		if(bytes < 0) {
+			fail("send");
+		}
+		data += bytes;
+		length -= bytes;
+	}
+}
+
+/*
+ * A minimal io_uring set up with the raw system calls, so the benchmark
+ * doesn't need liburing: one submission and one completion ring, mapped
+ * into memory as the kernel documents.
+ */
+struct Ring {
+	int fd = -1;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+
+	/**
+	 * @param entries Submission queue size
+	 * @returns Whether the kernel allows io_uring here
+	 */
+	bool setup(unsigned entries) {
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		fd = syscall(__NR_io_uring_setup, entries, &params);
+		if(fd < 0) {
+			return false;
+		}
+
+		size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if(params.features & IORING_FEAT_SINGLE_MMAP) {
+			sq_size = cq_size = std::max(sq_size, cq_size);
+		}
+		char *sq = (char *) mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				fd, IORING_OFF_SQ_RING);
+		char *cq = sq;
+		if(!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+			cq = (char *) mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					fd, IORING_OFF_CQ_RING);
+		}
+		sqes = (struct io_uring_sqe *) mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if(sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+			fail("mmap io_uring");
+		}
+
+		sq_tail = (unsigned *) (sq + params.sq_off.tail);
+		sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+		sq_array = (unsigned *) (sq + params.sq_off.array);
+		cq_head = (unsigned *) (cq + params.cq_off.head);
+		cq_tail = (unsigned *) (cq + params.cq_off.tail);
+		cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+		cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+		return true;
+	}
+
+	/**
+	 * Queue one request; the caller fills it in before calling submit()
+	 *
+	 * @returns The request, zeroed
+	 */
+	struct io_uring_sqe *next() {
+		unsigned tail = *sq_tail;
+		unsigned index = tail & *sq_mask;
+		sq_array[index] = index;
+		memset(&sqes[index], 0, sizeof(sqes[index]));
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+		return &sqes[index];
+	}
+
+	/**
+	 * Submit queued requests and wait for all of them to complete
+	 *
+	 * @param count Requests queued since the last submit
+	 * @param results Gets each request's result, indexed by its user_data
+	 */
+	void submit(unsigned count, long *results) {
+		if(counted(syscall(__NR_io_uring_enter, fd, count, count, IORING_ENTER_GETEVENTS, nullptr, 0)) < 0) {
+			fail("io_uring_enter");
+		}
+		unsigned head = *cq_head;
+		for(unsigned done = 0; done < count; done++, head++) {
+			while(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+				// all completions are posted before io_uring_enter() returns
+			}
+			struct io_uring_cqe &cqe = cqes[head & *cq_mask];
+			results[cqe.user_data] = cqe.res;
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	}
+};
+
+// What every strategy gets to work with
+struct Context {
+	int sock;
+	string path;
+	long size;
+	string header;
+	string contents;   // for "memory"
+	int pipe_fds[2];   // for "splice"
+	Ring ring;         // for "io_uring"
+	vector<char> buffer;
+};
+
+/**
+ * @returns Read system calls made by this process so far, from /proc
+ */
+long readSyscalls() {
+	int fd = open("/proc/self/io", O_RDONLY);
+	char text[512] = "";
+	ssize_t length = read(fd, text, sizeof(text) - 1);
+	close(fd);
+	const char *field = (length > 0) ? strstr(text, "syscr: ") : nullptr;
+	return field ? atol(field + 7) : 0;
+}
+
+void sendStream(Context &c) {
+	// the reads std::ifstream makes are counted from /proc by the caller
+	std::ifstream file(c.path, std::ios::binary);
+	syscalls += 2; // open and close
+	sendAll(c.sock, c.header.data(), c.header.length());
+	char buffer[4096];
+	while(file) {
+		file.read(buffer, sizeof(buffer));
+		if(file.gcount() > 0) {
+			sendAll(c.sock, buffer, file.gcount());
+		}
+	}
+	file.close();
+}
+
+void sendRead(Context &c) {
+	int fd = counted(open(c.path.c_str(), O_RDONLY));
+	sendAll(c.sock, c.header.data(), c.header.length());
+	ssize_t bytes;
+	while((bytes = counted(read(fd, c.buffer.data(), c.buffer.size()))) > 0) {
+		sendAll(c.sock, c.buffer.data(), bytes);
+	}
+	counted(close(fd));
+}
+
+void sendMemory(Context &c) {
+	sendAll(c.sock, c.header.data(), c.header.length());
+	sendAll(c.sock, c.contents.data(), c.contents.length());
+}
+
+void sendSendfile(Context &c) {
+	int fd = counted(open(c.path.c_str(), O_RDONLY));
+	sendAll(c.sock, c.header.data(), c.header.length());
+	off_t offset = 0;
+	while(offset < c.size) {
+		if(counted(sendfile(c.sock, fd, &offset, std::min(SLICE, c.size - offset))) <= 0) {
+			fail("sendfile");
+		}
+	}
+	counted(close(fd));
+}
+
+void sendMmap(Context &c) {
+	int fd = counted(open(c.path.c_str(), O_RDONLY));
+	char *body = (char *) counted(mmap(nullptr, c.size, PROT_READ, MAP_PRIVATE, fd, 0));
+	if(body == MAP_FAILED) {
+		fail("mmap");
+	}
+
+	struct iovec iov[2] = {{(void *) c.header.data(), c.header.length()}, {body, (size_t) c.size}};
+	struct iovec *next = iov;
+	int count = 2;
+	while(count > 0) {
+		ssize_t bytes = counted(writev(c.sock, next, count));
+		if(bytes < 0) {
+			fail("writev");
+		}
+		// skip what was sent, which can end partway through an entry
+		while(count > 0 && (size_t) bytes >= next->iov_len) {
+			bytes -= next->iov_len;
+			next++;
+			count--;
+		}
+		if(count > 0) {
+			next->iov_base = (char *) next->iov_base + bytes;
+			next->iov_len -= bytes;
+		}
+	}
+	counted(munmap(body, c.size));
+	counted(close(fd));
+}
+
+void sendSplice(Context &c) {
+	int fd = counted(open(c.path.c_str(), O_RDONLY));
+	sendAll(c.sock, c.header.data(), c.header.length());
+	loff_t offset = 0;
+	while(offset < c.size) {
+		ssize_t in_pipe = counted(splice(fd, &offset, c.pipe_fds[1], nullptr, c.size - offset,
+					SPLICE_F_MOVE | SPLICE_F_MORE));
+		if(in_pipe <= 0) {
+			fail("splice from file");
+		}
+		while(in_pipe > 0) {
+			ssize_t bytes = counted(splice(c.pipe_fds[0], nullptr, c.sock, nullptr, in_pipe,
+						SPLICE_F_MOVE | SPLICE_F_MORE));
+			if(bytes <= 0) {
+				fail("splice to socket");
+			}
+			in_pipe -= bytes;
+		}
+	}
+	counted(close(fd));
+}
+
+void sendUring(Context &c) {
+	int fd = counted(open(c.path.c_str(), O_RDONLY));
+	sendAll(c.sock, c.header.data(), c.header.length());
+	long offset = 0;
+	while(offset < c.size) {
+		// read and send each chunk in turn, all linked so they run in order
+		long lengths[2 * URING_CHUNKS];
+		unsigned queued = 0;
+		for(int chunk = 0; chunk < URING_CHUNKS && offset < c.size; chunk++) {
+			long length = std::min(SLICE, c.size - offset);
+			char *buffer = c.buffer.data() + chunk * SLICE;
+
+			struct io_uring_sqe *read_sqe = c.ring.next();
+			read_sqe->opcode = IORING_OP_READ;
+			read_sqe->fd = fd;
+			read_sqe->off = offset;
+			read_sqe->addr = (unsigned long) buffer;
+			read_sqe->len = length;
+			read_sqe->flags = IOSQE_IO_LINK;
+			read_sqe->user_data = queued;
+			lengths[queued++] = length;
+
+			struct io_uring_sqe *send_sqe = c.ring.next();
+			send_sqe->opcode = IORING_OP_SEND;
+			send_sqe->fd = c.sock;
+			send_sqe->addr = (unsigned long) buffer;
+			send_sqe->len = length;
+			send_sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+			send_sqe->flags = IOSQE_IO_LINK;
+			send_sqe->user_data = queued;
+			lengths[queued++] = length;
+
+			offset += length;
+		}
+		c.ring.sqes[(*c.ring.sq_tail - 1) & *c.ring.sq_mask].flags = 0; // end of the chain
+
+		long results[2 * URING_CHUNKS];
+		c.ring.submit(queued, results);
+		for(unsigned i = 0; i < queued; i++) {
+			if(results[i] != lengths[i]) {
+				errno = (results[i] < 0) ? -results[i] : EIO;
+				fail("io_uring read/send");
+			}
+		}
+	}
+	counted(close(fd));
+}
+
+struct Strategy {
+	const char *name;
+	void (*send)(Context &);
+	size_t buffer_size;
+	bool hidden_reads; // makes reads the tool can't count itself
+};
+
+const Strategy STRATEGIES[] = {
+	{"stream-4k", sendStream, 0, true},
+	{"read-64k", sendRead, 64 * 1024, false},
+	{"read-1m", sendRead, 1024 * 1024, false},
+	{"memory", sendMemory, 0, false},
+	{"sendfile", sendSendfile, 0, false},
+	{"mmap-writev", sendMmap, 0, false},
+	{"splice", sendSplice, 0, false},
+	{"io_uring", sendUring, URING_CHUNKS * SLICE, false},
+};
+
+/**
+ * Receiver thread: accept connections one at a time and read them to the
+ * end, as a client would
+ *
+ * @param listener The listening socket
+ * @param received Counts the bytes read
+ */
+void receiver(int listener, std::atomic<long> *received) {
+	vector<char> buffer(1024 * 1024);
+	while(true) {
+		int sock = accept(listener, nullptr, nullptr);
+		if(sock < 0) {
+			return; // the listener was shut down
+		}
+		ssize_t bytes;
+		while((bytes = recv(sock, buffer.data(), buffer.size(), 0)) > 0) {
+			*received += bytes;
+		}
+		close(sock);
+	}
+}
+
+/**
+ * Parse a byte count with an optional K, M or G suffix
+ *
+ * @param text E.g. "64M"
+ * @returns The number of bytes
+ */
+long parseBytes(const string &text) {
+	char *end;
+	double value = strtod(text.c_str(), &end);
+	switch(*end) {
+		case 'k': case 'K': value *= 1024; break;
+		case 'm': case 'M': value *= 1024 * 1024; break;
+		case 'g': case 'G': value *= 1024.0 * 1024 * 1024; break;
+	}
+	return (long) value;
+}
+
+/**
+ * Format a byte count for the report
+ *
+ * @param bytes The count
+ * @returns E.g. "64M"
+ */
+string formatBytes(long bytes) {
+	const char *units[] = {"", "K", "M", "G", "T"};
+	int unit = 0;
+	double value = bytes;
+	while(value >= 1024 && unit < 4) {
+		value /= 1024;
+		unit++;
+	}
+	char text[32];
+	snprintf(text, sizeof(text), value == (long) value ? "%.0f%s" : "%.1f%s", value, units[unit]);
+	return text;
+}
+
+/**
+ * Make a file of the given size with non-zero contents
+ *
+ * @param path Where
+ * @param size Bytes
+ */
+void makeFile(const string &path, long size) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		fail(path.c_str());
+	}
+	vector<char> block(1024 * 1024);
+	for(size_t i = 0; i < block.size(); i++) {
+		block[i] = 'a' + i % 26;
+	}
+	for(long written = 0; written < size; ) {
+		ssize_t bytes = write(fd, block.data(), std::min((long) block.size(), size - written));
+		if(bytes <= 0) {
+			fail("write");
+		}
+		written += bytes;
+	}
+	close(fd);
+}
+
+void usage(const char *program) {
+	cout << "Usage: " << program << " [options]\n";
+	cout << "  -s sizes    comma separated file sizes (default 1K,16K,256K,1M,16M,256M,1G)\n";
+	cout << "  -t strategies  comma separated, to run only some (default all)\n";
+	cout << "  -b bytes    bytes to send per size and strategy, at least 3 requests (default 1G)\n";
+	cout << "  -d dir      where to create the test files (default /tmp)\n";
+	cout << "  -C          drop each file from the page cache before every request\n";
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	string size_list = "1K,16K,256K,1M,16M,256M,1G";
+	string strategy_list;
+	long budget = 1024L * 1024 * 1024;
+	string dir = "/tmp";
+	bool cold = false;
+
+	int opt;
+	while((opt = getopt(argc, argv, "s:t:b:d:C")) != -1) {
+		switch(opt) {
+			case 's': size_list = optarg; break;
+			case 't': strategy_list = optarg; break;
+			case 'b': budget = parseBytes(optarg); break;
+			case 'd': dir = optarg; break;
+			case 'C': cold = true; break;
+			default: usage(argv[0]);
+		}
+	}
+	if(optind != argc) {
+		usage(argv[0]);
+	}
+
+	vector<long> sizes;
+	std::istringstream size_items(size_list);
+	string item;
+	while(getline(size_items, item, ',')) {
+		sizes.push_back(parseBytes(item));
+		if(sizes.back() <= 0) {
+			usage(argv[0]);
+		}
+	}
+	vector<const Strategy *> strategies;
+	for(const Strategy &strategy : STRATEGIES) {
+		if(strategy_list.empty() || ("," + strategy_list + ",").find(string(",") + strategy.name + ",") != string::npos) {
+			strategies.push_back(&strategy);
+		}
+	}
+	if(sizes.empty() || strategies.empty()) {
+		usage(argv[0]);
+	}
+
+	// loopback listener on any free port, and the thread reading from it
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addr_length = sizeof(addr);
+	if(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 16) != 0
+			|| getsockname(listener, (struct sockaddr *) &addr, &addr_length) != 0) {
+		fail("listen");
+	}
+	std::atomic<long> received(0);
+	std::thread receive_thread(receiver, listener, &received);
+
+	Context c;
+	if(pipe(c.pipe_fds) != 0) {
+		fail("pipe");
+	}
+	fcntl(c.pipe_fds[1], F_SETPIPE_SZ, 1024 * 1024); // fewer, larger splices where allowed
+	bool have_uring = c.ring.setup(2 * URING_CHUNKS);
+
+	printf("%-8s %-12s %10s %12s %14s\n", "size", "strategy", "MB/s", "CPU ms/GB", "syscalls/req");
+	std::map<long, std::pair<double, const char *>> fastest, cheapest;
+
+	for(long size : sizes) {
+		c.size = size;
+		c.path = dir + "/torero-sendbench-" + formatBytes(size);
+		makeFile(c.path, size);
+		c.header = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: "
+			+ std::to_string(size) + "\r\n\r\n";
+		long requests = std::max(3L, budget / std::max(size, 1L));
+		requests = std::min(requests, 20000L);
+
+		for(const Strategy *strategy : strategies) {
+			if(strategy->send == sendUring && !have_uring) {
+				printf("%-8s %-12s %10s\n", formatBytes(size).c_str(), strategy->name, "unavailable");
+				continue;
+			}
+			c.buffer.resize(strategy->buffer_size);
+			if(strategy->send == sendMemory) {
+				std::ifstream file(c.path, std::ios::binary);
+				c.contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			}
+
+			syscalls = 0;
+			received = 0;
+			double cpu_seconds = 0;
+			long reads_before = readSyscalls();
+			Clock::time_point start = Clock::now();
+			for(long i = 0; i < requests; i++) {
+				if(cold) {
+					int fd = open(c.path.c_str(), O_RDONLY);
+					posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+					close(fd);
+				}
+				c.sock = socket(AF_INET, SOCK_STREAM, 0);
+				if(connect(c.sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+					fail("connect");
+				}
+
+				struct timespec cpu_start, cpu_end;
+				clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+				strategy->send(c);
+				clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+				cpu_seconds += (cpu_end.tv_sec - cpu_start.tv_sec) + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+
+				// wait for the receiver to read everything before the next request
+				shutdown(c.sock, SHUT_WR);
+				char byte;
+				while(recv(c.sock, &byte, 1, 0) > 0) {
+				}
+				close(c.sock);
+			}
+			double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+			if(strategy->hidden_reads) {
+				// reading /proc the first time is one of the reads
+				syscalls += readSyscalls() - reads_before - 1;
+			}
+			c.contents.clear();
+			c.contents.shrink_to_fit();
+
+			long expected = requests * (size + (long) c.header.length());
+			if(received != expected) {
+				std::cerr << strategy->name << " delivered " << received << " bytes instead of " << expected << "\n";
+				exit(1);
+			}
+
+			double total_mb = (double) requests * size / (1024 * 1024);
+			double throughput = total_mb / elapsed;
+			double cpu_per_gb = cpu_seconds * 1000 / (total_mb / 1024);
+			printf("%-8s %-12s %10.0f %12.1f %14.1f\n", formatBytes(size).c_str(), strategy->name,
+					throughput, cpu_per_gb, (double) syscalls / requests);
+			fflush(stdout);
+
+			if(fastest[size].first < throughput) {
+				fastest[size] = {throughput, strategy->name};
+			}
+			if(cheapest[size].second == nullptr || cheapest[size].first > cpu_per_gb) {
+				cheapest[size] = {cpu_per_gb, strategy->name};
+			}
+		}
+		unlink(c.path.c_str());
+		printf("\n");
+	}
+
+	printf("%-8s %-12s %-12s\n", "size", "fastest", "least CPU");
+	for(long size : sizes) {
+		printf("%-8s %-12s %-12s\n", formatBytes(size).c_str(),
+				fastest[size].second ? fastest[size].second : "-", cheapest[size].second ? cheapest[size].second : "-");
+	}
+
+	shutdown(listener, SHUT_RDWR);
+	receive_thread.join();
+	close(listener);
+	return 0;
+}
@@ -0,0 +1,492 @@
+/*
+ * torero-soak: holds thousands of slow connections open against a server
+ * while timing a well-behaved client, to show how the server degrades under
+ * slow clients (and to prove that it no longer does).
+ *
+ * Slow connections are all driven by one epoll loop and can be
+ *   idle       connected, never sending anything (like client1-sim.sh
+ *              sleeping before its request, but forever)
+ *   slowloris  sending a request one byte per interval, never finishing it
+ *   trickle    sending a whole request, then reading the response a few
+ *              bytes per interval through a tiny receive buffer
+ * Connections the server closes, and trickle downloads that finish, are
+ * opened again so the pressure stays constant.
+ *
+ * Meanwhile a probe thread sends ordinary requests one after another and
+ * times them. Every second the tool prints the slow connections open, probe
+ * latencies and failures, and (given the server's pid, on the same machine)
+ * its resident memory, open fds and threads. Probes are taken for a few
+ * seconds before the slow clients start, as a baseline. The exit status is 0
+ * if no probe failed once the slow clients were in place and their p99
+ * stayed under the threshold.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cout;
+using std::string;
+using std::vector;
+
+using Clock = std::chrono::steady_clock;
+
+enum Mode {IDLE, SLOWLORIS, TRICKLE};
+
+// One slow connection
+struct SlowConn {
+	int fd = -1;
+	bool connected = false;
+	size_t sent = 0; // bytes of the request sent so far
+};
+
+// What the probe thread measured, collected by the main thread every second
+struct ProbeStats {
+	std::mutex m;
+	vector<double> latencies_ms;
+	long failures = 0;
+};
+
+/**
+ * Value at a percentile of sorted values
+ *
+ * @param sorted Values in ascending order
+ * @param percent Percentile, 0 to 100
+ * @returns The value, or 0 if there are none
+ */
+double percentile(const vector<double> &sorted, double percent) {
+	if(sorted.empty()) {
+		return 0;
+	}
+	size_t index = (size_t) (percent / 100 * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+/**
+ * Milliseconds until a deadline, for poll()
+ *
+ * @param deadline The deadline
+ * @returns Milliseconds, 0 if it has passed
+ */
+int msUntil(Clock::time_point deadline) {
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+	return std::max(0L, (long) left);
+}
+
+/**
+ * Send one request on a new connection and read the whole response, giving
+ * up at a deadline
+ *
+ * @param addr Address of the server
+ * @param request The request to send
+ * @param timeout_ms How long the whole exchange may take
+ * @returns Whether a 2xx or 3xx response arrived in full
+ */
+bool probeOnce(const struct addrinfo *addr, const string &request, int timeout_ms) {
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+	int sock = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+	if(sock < 0) {
+		return false;
+	}
+
+	struct pollfd pfd = {sock, POLLOUT, 0};
+	int error = 0;
+	socklen_t error_length = sizeof(error);
+	if((connect(sock, addr->ai_addr, addr->ai_addrlen) != 0 && errno != EINPROGRESS)
+			|| poll(&pfd, 1, msUntil(deadline)) != 1
+			|| getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_length) != 0 || error != 0
+			|| send(sock, request.data(), request.length(), MSG_NOSIGNAL) != (ssize_t) request.length()) {
+		close(sock);
+		return false;
+	}
+
+	string response;
+	char buffer[65536];
+	pfd.events = POLLIN;
+	while(true) {
+		ssize_t bytes = recv(sock, buffer, sizeof(buffer), 0);
+		if(bytes > 0) {
+			response.append(buffer, bytes);
+			continue;
+		}
+		if(bytes == 0) {
+			break; // the server closed the connection: complete
+		}
+		if(errno != EAGAIN || poll(&pfd, 1, msUntil(deadline)) != 1) {
+			close(sock);
+			return false; // error or timeout
+		}
+	}
+	close(sock);
+
+	// skip any 1xx responses (e.g. 103 Early Hints) before the final one
+	size_t start = 0;
+	while(response.compare(start, 10, "HTTP/1.1 1") == 0) {
+		size_t end = response.find("\r\n\r\n", start);
+		if(end == string::npos) {
+			return false;
+		}
+		start = end + 4;
+	}
+	return response.compare(start, 10, "HTTP/1.1 2") == 0 || response.compare(start, 10, "HTTP/1.1 3") == 0
+		|| response.compare(start, 10, "HTTP/1.0 2") == 0 || response.compare(start, 10, "HTTP/1.0 3") == 0;
+}
+
+/**
+ * Probe thread: time ordinary requests, one after another
+ *
+ * @param addr Address of the server
+ * @param request The request to send
+ * @param interval_ms Time between the starts of probes
+ * @param timeout_ms How long one probe may take before it counts as failed
+ * @param stats Gets the results
+ * @param stop Set when the test is over
+ */
+void prober(const struct addrinfo *addr, string request, int interval_ms, int timeout_ms,
+		ProbeStats *stats, std::atomic<bool> *stop) {
+	while(!*stop) {
+		Clock::time_point start = Clock::now();
+		bool ok = probeOnce(addr, request, timeout_ms);
+		double latency = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		{
+			std::lock_guard<std::mutex> lock(stats->m);
+			if(ok) {
+				stats->latencies_ms.push_back(latency);
+			}
+			else {
+				stats->failures++;
+			}
+		}
+		std::this_thread::sleep_until(start + std::chrono::milliseconds(interval_ms));
+	}
+}
+
+// Resource use of the server process, from /proc
+struct ServerUsage {
+	long rss_kb = 0;
+	long fds = 0;
+	long threads = 0;
+};
+
+/**
+ * Sample the server's resource use
+ *
+ * @param pid The server's pid
+ * @returns Its usage, all zero if it can't be read
+ */
+ServerUsage sampleServer(int pid) {
+	ServerUsage usage;
+	string proc = "/proc/" + std::to_string(pid);
+	std::ifstream status(proc + "/status");
+	string line;
+	while(getline(status, line)) {
+		if(line.compare(0, 6, "VmRSS:") == 0) {
+			usage.rss_kb = atol(line.c_str() + 6);
+		}
+		else if(line.compare(0, 8, "Threads:") == 0) {
+			usage.threads = atol(line.c_str() + 8);
+		}
+	}
+	DIR *fd_dir = opendir((proc + "/fd").c_str());
+	if(fd_dir != nullptr) {
+		while(readdir(fd_dir) != nullptr) {
+			usage.fds++;
+		}
+		usage.fds -= 2; // . and ..
+		closedir(fd_dir);
+	}
+	return usage;
+}
+
+/**
+ * Start a slow connection
+ *
+ * @param addr Address of the server
+ * @param mode What the connection does
+ * @param epoll_fd The epoll set that reports its connect and hang-up
+ * @param index Its index in the connections, for epoll
+ * @param conn Gets the socket
+ * @returns Whether the socket could be created
+ */
+bool openSlow(const struct addrinfo *addr, Mode mode, int epoll_fd, size_t index, SlowConn &conn) {
+	conn = SlowConn();
+	conn.fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+	if(conn.fd < 0) {
+		return false;
+	}
+	if(mode == TRICKLE) {
+		// the smallest receive buffer, so the server's sends fill it quickly
+		int size = 1;
+		setsockopt(conn.fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+	if(connect(conn.fd, addr->ai_addr, addr->ai_addrlen) != 0 && errno != EINPROGRESS) {
+		close(conn.fd);
+		conn.fd = -1;
+		return false;
+	}
+	struct epoll_event event = {};
+	event.events = EPOLLOUT | EPOLLRDHUP;
+	event.data.u64 = index;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn.fd, &event);
+	return true;
+}
+
+void usage(const char *program) {
+	cout << "Usage: " << program << " [options] host port\n";
+	cout << "  -n count    slow connections to hold open (default 10000)\n";
+	cout << "  -m mode     idle, slowloris or trickle (default idle)\n";
+	cout << "  -r rate     slow connections opened per second while ramping up (default 1000)\n";
+	cout << "  -i ms       slowloris/trickle interval between bytes sent or reads (default 1000)\n";
+	cout << "  -B bytes    trickle bytes read per interval (default 16)\n";
+	cout << "  -d secs     duration, from when the slow clients start (default 60)\n";
+	cout << "  -w secs     baseline probing before the slow clients start (default 3)\n";
+	cout << "  -u path     path to probe and (trickle) to download slowly (default /index.html)\n";
+	cout << "  -q ms       time between probes (default 100)\n";
+	cout << "  -T ms       probe timeout, and the p99 limit to pass (default 1000)\n";
+	cout << "  -p pid      the server's pid, to sample its memory, fds and threads\n";
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	size_t num_slow = 10000;
+	Mode mode = IDLE;
+	int ramp_rate = 1000;
+	int interval_ms = 1000;
+	int trickle_bytes = 16;
+	int duration = 60;
+	int warmup = 3;
+	string path = "/index.html";
+	int probe_interval_ms = 100;
+	int timeout_ms = 1000;
+	int server_pid = 0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:m:r:i:B:d:w:u:q:T:p:")) != -1) {
+		switch(opt) {
+			case 'n': num_slow = strtoul(optarg, nullptr, 10); break;
+			case 'm':
+				if(strcmp(optarg, "idle") == 0) mode = IDLE;
+				else if(strcmp(optarg, "slowloris") == 0) mode = SLOWLORIS;
+				else if(strcmp(optarg, "trickle") == 0) mode = TRICKLE;
+				else usage(argv[0]);
+				break;
+			case 'r': ramp_rate = std::max(1, atoi(optarg)); break;
+			case 'i': interval_ms = std::max(1, atoi(optarg)); break;
+			case 'B': trickle_bytes = std::max(1, atoi(optarg)); break;
+			case 'd': duration = atoi(optarg); break;
+			case 'w': warmup = atoi(optarg); break;
+			case 'u': path = optarg; break;
+			case 'q': probe_interval_ms = std::max(1, atoi(optarg)); break;
+			case 'T': timeout_ms = std::max(1, atoi(optarg)); break;
+			case 'p': server_pid = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if(argc - optind != 2) {
+		usage(argv[0]);
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *addr;
+	int error = getaddrinfo(argv[optind], argv[optind + 1], &hints, &addr);
+	if(error != 0) {
+		std::cerr << "Resolving " << argv[optind] << " failed: " << gai_strerror(error) << "\n";
+		exit(2);
+	}
+
+	// every slow connection is an fd here too
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	if(num_slow + 64 > limit.rlim_cur) {
+		num_slow = limit.rlim_cur - 64;
+		std::cerr << "Only " << num_slow << " slow connections fit in the fd limit\n";
+	}
+
+	string request = "GET " + path + " HTTP/1.1\r\nHost: " + argv[optind] + "\r\nUser-Agent: torero-soak\r\n\r\n";
+	const char *mode_names[] = {"idle", "slowloris", "trickle"};
+	cout << "Probing " << path << " every " << probe_interval_ms << " ms; " << warmup << " s baseline, then "
+		<< num_slow << " " << mode_names[mode] << " connections for " << duration << " s\n";
+	printf("%5s %8s %8s %10s %7s %6s %8s %8s %8s %7s %7s\n", "secs", "slow", "pending", "reconnects",
+			"probes", "fails", "p50 ms", "p99 ms", "max ms", "rss MB", "fds");
+
+	ProbeStats stats;
+	std::atomic<bool> stop(false);
+	std::thread probe_thread(prober, addr, request, probe_interval_ms, timeout_ms, &stats, &stop);
+
+	int epoll_fd = epoll_create1(0);
+	vector<SlowConn> conns(num_slow);
+	std::deque<std::pair<Clock::time_point, size_t>> timers; // next byte to send or read, in due order
+	size_t opened = 0;
+	long reconnects = 0;
+	vector<double> baseline, loaded;
+	long loaded_failures = 0;
+	ServerUsage peak;
+
+	Clock::time_point start = Clock::now();
+	Clock::time_point slow_start = start + std::chrono::seconds(warmup);
+	Clock::time_point end = slow_start + std::chrono::seconds(duration);
+	Clock::time_point next_report = start + std::chrono::seconds(1);
+
+	while(Clock::now() < end) {
+		Clock::time_point now = Clock::now();
+
+		// ramp up: open connections at the given rate since the slow start
+		if(now >= slow_start && opened < num_slow) {
+			double elapsed = std::chrono::duration<double>(now - slow_start).count();
+			size_t due = std::min(num_slow, (size_t) (elapsed * ramp_rate) + 1);
+			for(; opened < due; opened++) {
+				openSlow(addr, mode, epoll_fd, opened, conns[opened]);
+			}
+		}
+
+		struct epoll_event events[256];
+		int num_events = epoll_wait(epoll_fd, events, 256, 10);
+		for(int i = 0; i < num_events; i++) {
+			size_t index = events[i].data.u64;
+			SlowConn &conn = conns[index];
+			if(!conn.connected && (events[i].events & EPOLLOUT) && !(events[i].events & (EPOLLERR | EPOLLHUP))) {
+				conn.connected = true;
+				struct epoll_event event = {};
+				event.events = EPOLLRDHUP;
+				event.data.u64 = index;
+				epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &event);
+				if(mode == TRICKLE) {
+					send(conn.fd, request.data(), request.length(), MSG_NOSIGNAL);
+				}
+				if(mode != IDLE) {
+					timers.push_back({Clock::now() + std::chrono::milliseconds(interval_ms), index});
+				}
+				continue;
+			}
+			if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+				// the server gave up on it (or refused it): come back
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn.fd, nullptr);
+				close(conn.fd);
+				openSlow(addr, mode, epoll_fd, index, conn);
+				reconnects++;
+			}
+		}
+
+		// send or read the next few bytes on connections that are due
+		now = Clock::now();
+		while(!timers.empty() && timers.front().first <= now) {
+			size_t index = timers.front().second;
+			timers.pop_front();
+			SlowConn &conn = conns[index];
+			if(!conn.connected) {
+				continue; // reopened since; it gets a new timer once connected
+			}
+			if(mode == SLOWLORIS) {
+				// all of the request but the blank line that would end it,
+				// then one more header, over and over
+				if(conn.sent + 2 >= request.length()) {
+					send(conn.fd, "X-a: b\r\n", 8, MSG_NOSIGNAL);
+				}
+				else if(send(conn.fd, request.data() + conn.sent, 1, MSG_NOSIGNAL) == 1) {
+					conn.sent++;
+				}
+			}
+			else {
+				char buffer[4096];
+				ssize_t bytes = recv(conn.fd, buffer, std::min((int) sizeof(buffer), trickle_bytes), MSG_DONTWAIT);
+				if(bytes == 0) { // the download finished: start another
+					epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn.fd, nullptr);
+					close(conn.fd);
+					openSlow(addr, mode, epoll_fd, index, conn);
+					reconnects++;
+					continue;
+				}
+			}
+			timers.push_back({now + std::chrono::milliseconds(interval_ms), index});
+		}
+
+		if(Clock::now() >= next_report) {
+			vector<double> latencies;
+			long failures;
+			{
+				std::lock_guard<std::mutex> lock(stats.m);
+				latencies.swap(stats.latencies_ms);
+				failures = stats.failures;
+				stats.failures = 0;
+			}
+			std::sort(latencies.begin(), latencies.end());
+			bool before_slow = next_report <= slow_start;
+			bool ramped = opened == num_slow && next_report > slow_start + std::chrono::seconds(1);
+			if(before_slow) {
+				baseline.insert(baseline.end(), latencies.begin(), latencies.end());
+			}
+			else if(ramped) {
+				loaded.insert(loaded.end(), latencies.begin(), latencies.end());
+				loaded_failures += failures;
+			}
+
+			size_t connected = 0;
+			for(size_t i = 0; i < opened; i++) {
+				connected += conns[i].connected;
+			}
+			ServerUsage usage;
+			if(server_pid > 0) {
+				usage = sampleServer(server_pid);
+				peak.rss_kb = std::max(peak.rss_kb, usage.rss_kb);
+				peak.fds = std::max(peak.fds, usage.fds);
+				peak.threads = std::max(peak.threads, usage.threads);
+			}
+			double secs = std::chrono::duration<double>(next_report - start).count();
+			printf("%5.0f %8zu %8zu %10ld %7zu %6ld %8.1f %8.1f %8.1f %7.1f %7ld\n", secs, connected,
+					opened - connected, reconnects, latencies.size() + failures, failures,
+					percentile(latencies, 50), percentile(latencies, 99),
+					latencies.empty() ? 0 : latencies.back(), usage.rss_kb / 1024.0, usage.fds);
+			fflush(stdout);
+			next_report += std::chrono::seconds(1);
+		}
+	}
+
+	stop = true;
+	probe_thread.join();
+	for(size_t i = 0; i < opened; i++) {
+		if(conns[i].fd >= 0) {
+			close(conns[i].fd);
+		}
+	}
+	close(epoll_fd);
+	freeaddrinfo(addr);
+
+	std::sort(baseline.begin(), baseline.end());
+	std::sort(loaded.begin(), loaded.end());
+	printf("\nbaseline:          p50 %.1f ms  p99 %.1f ms\n", percentile(baseline, 50), percentile(baseline, 99));
+	printf("with slow clients: p50 %.1f ms  p99 %.1f ms  %ld of %zu probes failed\n", percentile(loaded, 50),
+			percentile(loaded, 99), loaded_failures, loaded.size() + loaded_failures);
+	if(server_pid > 0) {
+		printf("server peak:       %.1f MB resident, %ld fds, %ld threads\n", peak.rss_kb / 1024.0,
+				peak.fds, peak.threads);
+	}
+
+	bool passed = loaded_failures == 0 && !loaded.empty() && percentile(loaded, 99) <= timeout_ms;
+	return passed ? 0 : 1;
+}
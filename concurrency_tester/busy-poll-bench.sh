@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# Usage: busy-poll-bench.sh [HOSTNAME] [PORT_NUM] [REQUESTS]
+#
+# Latency profile for busy-poll mode. Sends REQUESTS requests for
+# /index.html one after another (so every request finds the server idle,
+# which is where busy polling matters) and prints the latency percentiles
+# in microseconds. Run it once against a server started normally and once
+# against one started with busy polling, e.g.
+#
+#   ./torero-serve -b 50 -P 2-5 8080 WWW
+
+server_hostname=$1
+port_num=$2
+requests=$3
+
+if [ "$#" -ne 3 ]; then
+	echo "Usage: busy-poll-bench.sh [HOSTNAME] [PORT_NUM] [REQUESTS]"
+	exit
+fi
+
+url="http://$server_hostname:$port_num/index.html"
+latencies=$(mktemp -d)/latencies.txt
+trap 'rm -rf "$(dirname "$latencies")"' EXIT
+
+# warm up the server's caches so the profile measures the network path
+for i in $(seq 20); do
+	curl -s -o /dev/null $url
+done
+
+echo "Timing $requests sequential requests for $url"
+for i in $(seq $requests); do
+	# time from sending the request to the last byte, in microseconds
+	curl -s -o /dev/null -w "%{time_total} %{time_pretransfer}\n" $url \
+		| awk '{ printf "%d\n", ($1 - $2) * 1000000 }'
+done | sort -n > "$latencies"
+
+count=$(wc -l < "$latencies")
+percentile() {
+	local index=$(( ($count * $1 + 99) / 100 ))
+	[ $index -lt 1 ] && index=1
+	sed -n "${index}p" "$latencies"
+}
+
+echo "p50: $(percentile 50) us"
+echo "p90: $(percentile 90) us"
+echo "p99: $(percentile 99) us"
+echo "max: $(tail -n 1 "$latencies") us"
@@ -0,0 +1,57 @@
+#!/bin/bash
+
+# Usage: encoded-asset.sh [HOSTNAME] [PORT_NUM] [ROOT_DIR]
+#
+# Checks that an asset referenced by a percent-encoded name is prefetched
+# under the same key a request for it uses. Writes "my file.css" and a page
+# linking it as "my%20file.css" into ROOT_DIR, the root the server was
+# started with, requests the page twice over HTTP/1.1 (the first request
+# loads the page's assets, the second gets them announced) and checks the
+# 103 Early Hints Link names /my%20file.css rather than a re-encoded
+# /my%2520file.css. If the server was started with -t, also checks the
+# stylesheet is then served from the cache. Both files are removed again.
+
+server_hostname=$1
+port_num=$2
+root_dir=$3
+
+if [ "$#" -ne 3 ]; then
+	echo "Usage: encoded-asset.sh [HOSTNAME] [PORT_NUM] [ROOT_DIR]"
+	exit
+fi
+
+page="encoded-asset-test.html"
+asset="my file.css"
+echo '<html><head><link rel="stylesheet" href="my%20file.css"></head><body></body></html>' > "$root_dir/$page"
+echo 'body { color: black; }' > "$root_dir/$asset"
+size=$(wc -c < "$root_dir/$asset")
+
+url="http://$server_hostname:$port_num"
+failed=0
+curl -s -o /dev/null --http1.1 "$url/$page"
+sleep 1
+headers=$(curl -s -o /dev/null -D - --http1.1 "$url/$page" | tr -d '\r')
+if ! grep -q '^Link: </my%20file.css>' <<< "$headers"; then
+	echo "Early Hints for /$page don't link /my%20file.css:"
+	echo "$headers"
+	failed=1
+fi
+
+headers=$(curl -s -o /dev/null -D - -w "%{http_code} %{size_download}" "$url/my%20file.css" | tr -d '\r')
+if [ "$(tail -n 1 <<< "$headers")" != "200 $size" ]; then
+	echo "/my%20file.css got \"$(tail -n 1 <<< "$headers")\", expected \"200 $size\""
+	failed=1
+fi
+if grep -q '^Server-Timing:' <<< "$headers" && ! grep -q '^Server-Timing:.*hit' <<< "$headers"; then
+	echo "/my%20file.css wasn't prefetched into the cache:"
+	echo "$headers"
+	failed=1
+fi
+rm -f "$root_dir/$page" "$root_dir/$asset"
+
+if [ $failed -eq 0 ]; then
+	echo "Encoded asset test passed!"
+else
+	echo "Encoded asset test failed!"
+	exit 1
+fi
@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# Usage: inline-data-uri.sh [HOSTNAME] [PORT_NUM] [ROOT_DIR]
+#
+# Checks that an HTML page with a large inline data: URI is served, and that
+# scanning it for assets to prefetch doesn't take the server down. Writes a
+# page of about 400 KB (a base64 data: image plus one ordinary stylesheet
+# link) into ROOT_DIR, the root the server was started with, requests it
+# twice (once from disk, once from the cache) and then checks the server
+# still answers /index.html. The page is removed again afterwards.
+
+server_hostname=$1
+port_num=$2
+root_dir=$3
+
+if [ "$#" -ne 3 ]; then
+	echo "Usage: inline-data-uri.sh [HOSTNAME] [PORT_NUM] [ROOT_DIR]"
+	exit
+fi
+
+page="data-uri-test.html"
+{
+	echo '<html><head><link rel="stylesheet" href="style.css"></head><body>'
+	printf '<img src="data:image/png;base64,'
+	head -c 300000 /dev/urandom | base64 -w 0
+	echo '">'
+	echo '</body></html>'
+} > "$root_dir/$page"
+size=$(wc -c < "$root_dir/$page")
+
+url="http://$server_hostname:$port_num"
+failed=0
+for attempt in 1 2; do
+	received=$(curl -s -o /dev/null -w "%{http_code} %{size_download}" "$url/$page")
+	if [ "$received" != "200 $size" ]; then
+		echo "Request $attempt for /$page got \"$received\", expected \"200 $size\""
+		failed=1
+	fi
+done
+if [ "$(curl -s -o /dev/null -w "%{http_code}" "$url/index.html")" != "200" ]; then
+	echo "The server no longer answers /index.html"
+	failed=1
+fi
+rm -f "$root_dir/$page"
+
+if [ $failed -eq 0 ]; then
+	echo "Inline data URI test passed!"
+else
+	echo "Inline data URI test failed!"
+	exit 1
+fi
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# Usage: slow-client-soak.sh [HOSTNAME] [PORT_NUM] [CONNECTIONS] [MODE]
+#
+# Soak test for slow clients. Holds CONNECTIONS slow connections open (MODE
+# is idle, slowloris or trickle) while a well-behaved client keeps
+# requesting /index.html, and checks that it is still answered promptly.
+# Every second it prints the probe latencies and, when the server runs on
+# this machine, its memory and open fds. Build bench/torero-soak first
+# (make in bench/), and give the server enough fds, e.g.
+#
+#   ulimit -n 65536; ./torero-serve -c 0 8080 WWW
+#
+# (-c 0 because all the connections come from one address.) Extra options
+# for torero-soak, such as -d 300 for a longer run, can be passed in
+# SOAK_OPTS.
+
+server_hostname=$1
+port_num=$2
+connections=$3
+mode=$4
+
+if [ "$#" -ne 4 ]; then
+	echo "Usage: slow-client-soak.sh [HOSTNAME] [PORT_NUM] [CONNECTIONS] [MODE]"
+	exit
+fi
+
+soak="$(dirname "$0")/../bench/torero-soak"
+if [ ! -x "$soak" ]; then
+	echo "$soak not found; run make in bench/ first"
+	exit 1
+fi
+
+# sample the server's memory and fds if it runs here
+server_pid=$(pgrep -n -f "torero-serve.* $port_num( |$)")
+pid_opt=""
+if [ -n "$server_pid" ]; then
+	pid_opt="-p $server_pid"
+fi
+
+ulimit -n $(ulimit -Hn)
+
+echo "Opening $connections $mode connections to $server_hostname:$port_num"
+if "$soak" -n $connections -m $mode $pid_opt $SOAK_OPTS $server_hostname $port_num; then
+	echo "Slow client soak test passed!"
+else
+	echo "Slow client soak test failed! Well-behaved clients were delayed or refused."
+fi
@@ -17,14 +17,20 @@
 #include <cerrno>
 
 // operating system specific libraries
+#include <dirent.h>
+#include <fcntl.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/select.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <csignal>
 
 // C++ standard libraries
 #include <vector>
@@ -35,8 +41,30 @@
 #include <filesystem>
 #include <regex>
 #include <fstream>
+#include <sstream>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 
 #include "BoundedBuffer.hpp"
+#include "ClientLimiter.hpp"
+#include "ContentCache.hpp"
+#include "AssetPrefetcher.hpp"
+#include "PathFilter.hpp"
+#include "UrlPath.hpp"
+#include "OpenBeneath.hpp"
+#include "DiskPool.hpp"
+#include "CompletionQueue.hpp"
+#include "Job.hpp"
+#include "NumaTopology.hpp"
+#include "SpinWait.hpp"
+#include "MemoryPressure.hpp"
+#include "CgroupLimits.hpp"
+#include "Watchdog.hpp"
 
 #define BUFFER_SIZE 2048
 #define TRANSACTION_CLOSE 2
@@ -51,55 +79,496 @@ using std::thread;
 
 // This will limit how many clients can be waiting for a connection.
 static const int BACKLOG = 10;
+
+// Per node: connections waiting for a worker, and fast lane workers. In a
+// container with a CPU limit these are scaled down to WORKERS_PER_CPU
+// workers per CPU the node gets (see sizeShard), never below 2.
 const size_t CAPACITY = 10;
 const size_t NUM_THREADS = 8;
+const double WORKERS_PER_CPU = 2;
+
+// Workers reserved for responses with bodies too large for the content
+// cache (the bulk lane); the NUM_THREADS workers above handle everything
+// else (the fast lane).
+const size_t BULK_THREADS = 4;
+
+// Threads that do the disk work (open, stat, getdents, read) that could
+// block, and how many jobs may wait for one of them. Requests that need the
+// disk while the queue is full get a 503.
+const int DISK_THREADS = 4;
+const int DISK_QUEUE = 64;
+
+// Files larger than the content cache takes are sent in slices of this many
+// bytes, checking before each one that it is in the page cache. Concurrent
+// transfers take turns one slice at a time.
+const off_t STREAM_SLICE = 256 * 1024;
+
+// A transfer parked because its client isn't reading is closed once it has
+// waited PARK_LIMIT, freeing its socket, file and connection slot. Bulk lane
+// workers wake every PARK_CHECK to look for such transfers.
+const std::chrono::seconds PARK_LIMIT(60);
+const int PARK_CHECK_MS = 1000;
+
+// Files up to CACHE_MAX_OBJECT bytes are kept in memory once served, up to
+// CACHE_BUDGET bytes in total, or 1/CACHE_MEMORY_SHARE of the container's
+// memory limit if that is less. The limits are read again every
+// LIMITS_INTERVAL so the budget follows a resized container.
+const size_t CACHE_BUDGET = 64 * 1024 * 1024;
+const size_t CACHE_MAX_OBJECT = 1024 * 1024;
+const size_t CACHE_MEMORY_SHARE = 4;
+const std::chrono::seconds LIMITS_INTERVAL(60);
+
+// Directory listings are cached too, under the directory's stat, so they
+// are rebuilt whenever an entry is added, removed or renamed. JSON listings
+// also show each file's size and mtime, which can change without touching
+// the directory, so they are rebuilt at least every JSON_LISTING_MAX_AGE.
+const std::chrono::seconds JSON_LISTING_MAX_AGE(1);
+
+// Everything the threads of one NUMA node share: its acceptors feed its
+// buffer, its workers and disk pool serve only those connections, and each
+// node keeps its own content cache (of up to CACHE_BUDGET bytes). A shard
+// is built, and its threads started, while pinned to the node's CPUs, so
+// its memory is first touched, and hence placed, on that node.
+struct NodeShard {
+	NumaNode node;
+	BoundedBuffer buffer;
+	CompletionQueue fast_lane;
+	CompletionQueue bulk_lane;
+	ContentCache content_cache;
+
+	// Loads the stylesheets, images and scripts of served HTML pages into
+	// content_cache ahead of the browser asking for them.
+	AssetPrefetcher prefetcher;
+	DiskPool disk_pool;
+
+	NodeShard(const NumaNode &node, std::function<void(Job &)> work, size_t capacity, size_t cache_budget)
+		: node(node), buffer(capacity), fast_lane(PARK_LIMIT), bulk_lane(PARK_LIMIT), content_cache(cache_budget, CACHE_MAX_OBJECT), prefetcher(content_cache),
+		disk_pool(DISK_THREADS, DISK_QUEUE, work, fast_lane, bulk_lane) {}
+};
+
+// How many threads, queued connections and cached bytes one node's shard
+// gets, scaled to the container's limits (see sizeShard)
+struct ShardSizing {
+	size_t fast_workers;
+	size_t bulk_workers;
+	size_t capacity;
+	size_t cache_budget;
+};
+
+// Shared objects used by detached threads are allocated once and never
+// destroyed, so they are still valid if exit() runs while a thread uses them.
+static vector<NodeShard *> shards;
+
+// Roots with up to MAX_SNAPSHOT_PATHS entries are snapshotted into a Bloom
+// filter so requests for missing paths are answered without the disk; the
+// last MAX_NEGATIVE_PATHS misses that got past it are remembered too.
+const size_t MAX_SNAPSHOT_PATHS = 1000000;
+const size_t MAX_NEGATIVE_PATHS = 4096;
+
+static PathFilter &path_filter = *new PathFilter(MAX_SNAPSHOT_PATHS, MAX_NEGATIVE_PATHS);
+
+// Most connections one client address may have open at once. Set with -c;
+// 0 turns the limit off. The default matches what browsers open per host.
+static int max_per_client = 6;
+
+// Addresses to listen on, one listener each. Set with -l (repeatable); when
+// none are given the server listens on "::" as a dual-stack IPv6/IPv4 socket.
+static vector<string> listen_addresses;
+
+// Directory holding custom error pages named by status code (e.g. 404.html).
+// Set with -e; statuses without a page get a short built-in one.
+static std::string error_page_dir;
+
+// Complete error and status responses (status line, headers and body) keyed
+// by status code. Built once at startup so sending one is a single write.
+static std::unordered_map<int, std::string> status_responses;
+
+// Open directory fd of the document root. Every request path is resolved
+// relative to it and is not allowed to leave it.
+static int root_fd = -1;
+
+// Busy-poll mode for latency-critical deployments, set with -b: client
+// sockets busy poll the NIC for this many microseconds (SO_BUSY_POLL with
+// SO_PREFER_BUSY_POLL), and workers with a CPU of their own spin before they
+// sleep. 0 is off.
+static int busy_poll_usecs = 0;
+
+// CPUs for the fast lane workers in busy-poll mode, one worker each, set
+// with -P. By default the CPUs isolated with isolcpus= are used, if any.
+static vector<int> busy_poll_cpus;
+
+// Reports network workers that spend more than stall_limit seconds on one
+// stage of a connection (set with -w, 0 turns it off), and with -k also
+// shuts those connections down so the workers are freed.
+static Watchdog &watchdog = *new Watchdog();
+static int stall_limit = 120;
+static bool close_stalled = false;
+
+// Whether 200 responses carry a Server-Timing header with how long the
+// request spent in each stage, so browser devtools can show it. Set with -t.
+static bool server_timing = false;
+
+// Names tried, in order, when a directory is requested. Set with -i.
+static vector<string> index_files = {"index.html", "index.htm"};
+
+// Remembers which index file (if any) each directory had, keyed by the
+// directory path and validated against the directory's modification time.
+struct IndexEntry {
+	struct timespec dir_mtime;
+	std::string index_name; // empty when the directory has no index file
+};
+static std::unordered_map<std::string, IndexEntry> index_cache;
+static std::mutex index_cache_mutex;
+
+// Closes a file descriptor when it goes out of scope, the way std::ifstream
+// closes its file, so early returns and exceptions can't leak it.
+struct FdCloser {
+	int fd;
+	~FdCloser() {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+};
+
+// One entry of a directory listing
+struct DirEntry {
+	std::string name;
+	bool is_dir;
+	off_t size;
+	time_t mtime;
+};
+
+// What a network worker does with a job after respond()
+enum NextStep {
+	DONE,      // the response is complete, close the connection
+	DISK_WORK, // submit it to the disk pool (its stage says for what)
+	BULK_LANE, // put it at the back of the bulk lane
+	WAIT_WRITABLE // park it on the bulk lane until its socket is writable
+};
 
 // forward declarations
-int createSocketAndListen(const int port_num);
-void acceptConnections(const int server_sock, std::string root);
-void handleClient(const int client_sock, std::string root);
+int createSocketAndListen(const std::string &address, const int port_num, bool v6only,
+		bool reuse_port);
+void acceptConnections(const int server_sock, BoundedBuffer &buffer, ClientLimiter &limiter);
+bool handleClient(Job &job, std::string root);
+bool resolve(Job &job, bool may_block);
+NextStep respond(Job &job, std::string root);
+void diskWork(Job &job);
 void sendData(int socked_fd, const char *data, size_t data_length);
 int receiveData(int socked_fd, char *dest, size_t buff_size);
-void consume(BoundedBuffer &buffer, std::string root);
-bool isDirectory(std::string filename);
-bool fileExists(std::string filename);
+void consume(int shard_index, ClientLimiter &limiter, std::string root, bool bulk_worker,
+		bool spinning);
+vector<DirEntry> listDirectory(int dir_fd);
 bool validGET(std::string request);
-void sendBad(const int client_sock);
-void sendNotFound(const int client_sock);
-void sendOK(const int client_sock);
-void sendError(const int client_sock);
-void sendHeader(const int client_sock, std::string filename);
-void sendHTML(const int client_sock, std::string filename);
-void sendFile(const int client_sock, std::string filename);
+void sendStatus(const int client_sock, int status);
+void sendTooMany(const int client_sock);
+void sendOK(const int client_sock, const std::string &headers = "", bool after_hints = false);
+std::string serverTiming(const Job &job);
+void buildStatusResponses(std::string error_dir);
+void sendHeader(const int client_sock, std::string filename, const struct stat &info);
+std::string htmlListing(int dir_fd);
+std::string jsonListing(int dir_fd);
+std::shared_ptr<const std::string> cachedListing(Job &job, int dir_fd, const struct stat &dir_info,
+		bool may_block);
+void sendPage(const int client_sock, std::string type, const std::string &page);
+bool wantsJSON(std::string request, std::string query);
+std::string jsonEscape(std::string text);
+void sendRedirect(const int client_sock, std::string location);
+bool findIndex(std::string dirname, int dir_fd, const struct stat &dir_info, bool may_block,
+		std::string &index_name);
+vector<string> splitList(std::string list);
+bool isHTML(std::string filename);
+bool sendEarlyHints(const int client_sock, std::string page, std::string root,
+		AssetPrefetcher &prefetcher);
+ShardSizing sizeShard(const NumaNode &node, size_t total_cpus, size_t num_nodes, const CgroupLimits &limits);
+size_t cacheBudget(size_t num_nodes, const CgroupLimits &limits);
+void watchLimits(MemoryPressure &memory_pressure, size_t num_nodes, CgroupLimits limits);
 
 int main(int argc, char** argv) {
 
+	// Read the optional flags that come before the port and root
+	int opt;
+	while ((opt = getopt(argc, argv, "b:c:e:i:kl:P:tw:")) != -1) {
+		switch (opt) {
+			case 'b': // busy-poll mode, with the busy poll time in microseconds
+				busy_poll_usecs = std::stoi(optarg);
+				break;
+			case 'P': // CPUs for the busy-polling workers
+				busy_poll_cpus = parseCpuList(optarg);
+				break;
+			case 'c': // connections allowed per client address
+				max_per_client = std::stoi(optarg);
+				break;
+			case 'e': // directory of custom error pages
+				error_page_dir = optarg;
+				break;
+			case 'l': // address to listen on, may be given more than once
+				listen_addresses.push_back(optarg);
+				break;
+			case 'i': // comma separated index file names, tried in order
+				index_files = splitList(optarg);
+				break;
+			case 'w': // seconds a worker may spend on one stage of a connection
+				stall_limit = std::stoi(optarg);
+				break;
+			case 'k': // shut down the connections of stuck workers
+				close_stalled = true;
+				break;
+			case 't': // add a Server-Timing header to 200 responses
+				server_timing = true;
+				break;
+			default:
+				argc = 0; // force the usage message below
+				break;
+		}
+	}
+
 	/* Make sure the user called our program correctly. */
-	if (argc != 3) {
+	if (argc - optind != 2) {
 		cout << "INCORRECT USAGE!\n";
-		cout << "Format: './(compiled exec) (port num) (root directory)'\n";
+		cout << "Format: './(compiled exec) [options] (port num) (root directory)'\n";
+		cout << "  -b usecs   busy-poll mode: sockets busy poll for usecs, idle workers spin\n";
+		cout << "  -c count   connections allowed per client address, 0 for no limit (default 6)\n";
+		cout << "  -e dir     directory with custom error pages named (status).html\n";
+		cout << "  -i names   comma separated index files (default index.html,index.htm)\n";
+		cout << "  -k         close the connections of workers stuck longer than -w allows\n";
+		cout << "  -l addr    IPv4 or IPv6 address to listen on, repeatable (default ::)\n";
+		cout << "  -P cpus    CPUs for busy-poll workers, e.g. 2-5 (default: isolated CPUs)\n";
+		cout << "  -t         add a Server-Timing header with per-stage durations\n";
+		cout << "  -w secs    report workers stuck this long on one connection, 0 for never (default 120)\n";
 		exit(1);
 	}
 
 	/* Read the port number from the first command line argument. */
-	int port = std::stoi(argv[1]);
+	int port = std::stoi(argv[optind]);
+
+	// Read the root directory from the command line. File names built from
+	// it are cache keys, so it is normalized once ("./WWW/" becomes "WWW")
+	// and the prefetcher, given the same string, builds the same keys.
+	std::string root = fs::path(argv[optind + 1]).lexically_normal().string();
+	while (root.length() > 1 && root.back() == '/') {
+		root.pop_back();
+	}
+	root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (root_fd < 0) {
+		perror("Opening root directory failed");
+		exit(1);
+	}
 
-	// Read the root directory from the command line
-	std::string root = (argv[2]);
+	// sendfile() has no MSG_NOSIGNAL, so a client hanging up mid-transfer
+	// would kill the server with SIGPIPE; treat it as a send error instead
+	signal(SIGPIPE, SIG_IGN);
 
 	/* Create a socket and start listening for new connections on the
-	 * specified port. */
-	int server_sock = createSocketAndListen(port);
+	 * specified port, once for every listen address. An IPv6 wildcard socket
+	 * also takes IPv4 connections (dual-stack) unless an IPv4 address was
+	 * given explicitly, in which case the two would collide on the port. */
+	bool dual_stack = listen_addresses.empty();
+	if (dual_stack) {
+		listen_addresses.push_back("::");
+	}
+	bool has_ipv4 = false;
+	for (const std::string &address : listen_addresses) {
+		if (address.find(':') == std::string::npos) {
+			has_ipv4 = true;
+		}
+	}
 
-	/* Now let's start accepting connections. */
-	acceptConnections(server_sock, root);
+	/* With more than one NUMA node, every node gets its own listening socket
+	 * on each address (SO_REUSEPORT lets them share it), so a connection is
+	 * accepted, parsed and answered all on one node. */
+	vector<NumaNode> nodes = numaNodes();
+	bool numa = (nodes.size() > 1);
+	size_t total_cpus = 0;
+	for (const NumaNode &node : nodes) {
+		total_cpus += node.cpus.size();
+	}
+	CgroupLimits limits = cgroupLimits();
+
+	vector<vector<int>> server_socks(nodes.size()); // per node
+	for (size_t n = 0; n < nodes.size(); n++) {
+		for (const std::string &address : listen_addresses) {
+			int server_sock = createSocketAndListen(address, port, has_ipv4, numa);
+			if (server_sock < 0 && dual_stack) { // no IPv6 on this host
+				server_sock = createSocketAndListen("0.0.0.0", port, true, numa);
+			}
+			if (server_sock < 0) {
+				exit(1);
+			}
+			server_socks[n].push_back(server_sock);
+		}
+	}
+
+	buildStatusResponses(error_page_dir);
+	path_filter.start(root);
+	if (stall_limit > 0) {
+		watchdog.start(std::chrono::seconds(stall_limit), close_stalled);
+	}
+	ClientLimiter limiter(max_per_client);
+
+	/* Build each node's shard and start its threads while pinned to the
+	 * node's CPUs; new threads inherit the pinning. Then start accepting
+	 * connections, with a thread per listener so that a busy listener never
+	 * delays accepts on another. */
+	if (busy_poll_usecs > 0 && busy_poll_cpus.empty()) {
+		busy_poll_cpus = isolatedCpus();
+	}
+	vector<thread> acceptors;
+	size_t spinning_workers = 0;
+	// the threads of the first nodes index shards while later nodes are
+	// added, so it must never reallocate
+	shards.reserve(nodes.size());
+	for (size_t n = 0; n < nodes.size(); n++) {
+		if (numa) {
+			pinThread(nodes[n].cpus);
+		}
+		ShardSizing sizing = sizeShard(nodes[n], total_cpus, nodes.size(), limits);
+		NodeShard *shard = new NodeShard(nodes[n], diskWork, sizing.capacity, sizing.cache_budget);
+		shards.push_back(shard);
+		shard->prefetcher.start(root, root_fd);
+
+		// in busy-poll mode the first fast lane workers get one of the node's
+		// busy-poll CPUs each and spin on it; spinning only pays off on a CPU
+		// of its own, so the other workers sleep when idle as usual. Isolated
+		// CPUs are usually outside the inherited affinity mask, so candidates
+		// come from all of the node's CPUs and are pinned to explicitly.
+		vector<int> worker_cpus;
+		if (busy_poll_usecs > 0) {
+			for (int cpu : busy_poll_cpus) {
+				if (std::find(nodes[n].all_cpus.begin(), nodes[n].all_cpus.end(), cpu) != nodes[n].all_cpus.end()) {
+					worker_cpus.push_back(cpu);
+				}
+			}
+		}
+
+		for(size_t i = 0; i < sizing.fast_workers + sizing.bulk_workers; i++) { // fast lane workers first, then the bulk lane
+			bool bulk_worker = (i >= sizing.fast_workers);
+			bool spinning = false;
+			if (i < worker_cpus.size() && !bulk_worker) {
+				spinning = pinThread({worker_cpus[i]});
+				if (!spinning) {
+					std::cerr << "Can't run a busy-poll worker on CPU " << worker_cpus[i]
+						<< " (outside this process's cpuset?)\n";
+				}
+				spinning_workers += spinning;
+			}
+			if (!spinning && !worker_cpus.empty()) {
+				pinThread(nodes[n].cpus);
+			}
+			std::thread cons(consume, (int) n, std::ref(limiter), root, bulk_worker, spinning);
+			cons.detach();
+		}
+		if (!worker_cpus.empty()) {
+			pinThread(nodes[n].cpus);
+		}
+		for (int server_sock : server_socks[n]) {
+			acceptors.push_back(thread(acceptConnections, server_sock, std::ref(shard->buffer), std::ref(limiter)));
+		}
+	}
+
+	if (busy_poll_usecs > 0 && spinning_workers == 0) {
+		std::cerr << "Busy-poll mode: no CPUs for spinning workers (give -P or boot with isolcpus=), "
+			<< "workers sleep when idle\n";
+	}
+
+	/* Shrink the content caches when memory runs short, before the kernel
+	 * or the container's OOM killer has to step in. */
+	vector<ContentCache *> caches;
+	vector<AssetPrefetcher *> prefetchers;
+	for (NodeShard *shard : shards) {
+		caches.push_back(&shard->content_cache);
+		prefetchers.push_back(&shard->prefetcher);
+	}
+	MemoryPressure *memory_pressure = new MemoryPressure(caches, prefetchers, cacheBudget(nodes.size(), limits));
+	memory_pressure->start();
+	std::thread limits_watcher(watchLimits, std::ref(*memory_pressure), nodes.size(), limits);
+	limits_watcher.detach();
+
+	for (thread &acceptor : acceptors) {
+		acceptor.join();
+	}
 	
-	// Close socket
-	close(server_sock);
+	// Close sockets
+	for (const vector<int> &node_socks : server_socks) {
+		for (int server_sock : node_socks) {
+			close(server_sock);
+		}
+	}
 
 	return 0;
 }
 
+/**
+ * Size a node's shard to what the container allows. Without a cgroup CPU
+ * limit below the node's own CPUs the defaults are used as they are; with
+ * one, the node gets its share of the limit and WORKERS_PER_CPU fast lane
+ * workers per CPU of it (and a bulk lane worker per CPU), up to the
+ * defaults. The connection buffer shrinks in step with the workers.
+ *
+ * @param node The node
+ * @param total_cpus CPUs over all nodes
+ * @param num_nodes How many nodes there are
+ * @param limits The cgroup's limits
+ * @returns The sizes for the node's shard
+ */
+ShardSizing sizeShard(const NumaNode &node, size_t total_cpus, size_t num_nodes, const CgroupLimits &limits) {
+	ShardSizing sizing{NUM_THREADS, BULK_THREADS, CAPACITY, cacheBudget(num_nodes, limits)};
+
+	if (limits.cpus > 0 && limits.cpus < total_cpus) {
+		double node_cpus = limits.cpus * node.cpus.size() / total_cpus;
+		sizing.fast_workers = std::clamp((size_t) std::ceil(node_cpus * WORKERS_PER_CPU), (size_t) 2, NUM_THREADS);
+		sizing.bulk_workers = std::clamp((size_t) std::ceil(node_cpus), (size_t) 1, BULK_THREADS);
+		sizing.capacity = std::max((size_t) 2, (CAPACITY * sizing.fast_workers + NUM_THREADS - 1) / NUM_THREADS);
+		std::cerr << "cgroup allows " << limits.cpus << " CPUs: node " << node.id << " gets "
+			<< sizing.fast_workers << " fast and " << sizing.bulk_workers << " bulk workers\n";
+	}
+	return sizing;
+}
+
+/**
+ * Work out each node's content cache budget: CACHE_BUDGET, or the nodes'
+ * share of 1/CACHE_MEMORY_SHARE of the cgroup's memory limit if that is less
+ *
+ * @param num_nodes How many nodes share the memory
+ * @param limits The cgroup's limits
+ * @returns The budget in bytes
+ */
+size_t cacheBudget(size_t num_nodes, const CgroupLimits &limits) {
+	if (limits.memory == 0) {
+		return CACHE_BUDGET;
+	}
+	return std::min(CACHE_BUDGET, limits.memory / CACHE_MEMORY_SHARE / num_nodes);
+}
+
+/**
+ * Re-read the cgroup's limits every LIMITS_INTERVAL and follow changes: the
+ * cache budget is resized at once, while new thread counts would only apply
+ * after a restart, so a changed CPU limit is just reported.
+ *
+ * @param memory_pressure Owns the caches' budget
+ * @param num_nodes How many nodes there are
+ * @param limits The limits the server was sized to
+ */
+void watchLimits(MemoryPressure &memory_pressure, size_t num_nodes, CgroupLimits limits) {
+	while (true) {
+		std::this_thread::sleep_for(LIMITS_INTERVAL);
+		CgroupLimits now = cgroupLimits();
+
+		if (now.memory != limits.memory) {
+			size_t budget = cacheBudget(num_nodes, now);
+			memory_pressure.setBudget(budget);
+			std::cerr << "cgroup memory limit changed: cache budget now " << budget / (1024 * 1024)
+				<< " MB per node\n";
+		}
+		if (now.cpus != limits.cpus) {
+			std::cerr << "cgroup CPU limit changed from " << limits.cpus << " to " << now.cpus
+				<< " CPUs; restart the server to resize its workers\n";
+		}
+		limits = now;
+	}
+}
+
 /**
  * Sends message over given socket, raising an exception if there was a problem
  * sending.
@@ -110,7 +579,8 @@ int main(int argc, char** argv) {
  */
 void sendData(int socked_fd, const char *data, size_t data_length) {
 	while(data_length > 0) {
-		int num_bytes_sent = send(socked_fd, data, data_length, 0);
+		// MSG_NOSIGNAL: a client hanging up should be an error, not SIGPIPE
+		int num_bytes_sent = send(socked_fd, data, data_length, MSG_NOSIGNAL);
 		if (num_bytes_sent == -1) {
 			std::error_code ec(errno, std::generic_category());
 			throw std::system_error(ec, "send failed");
@@ -140,65 +610,386 @@ int receiveData(int socked_fd, char *dest, size_t buff_size) {
 }
 
 /**
- * Receives a request from a connected HTTP client and sends back the
- * appropriate response.
+ * Receives a request from a connected HTTP client and parses it into a job.
+ * Requests that can be answered without looking at the disk (bad requests,
+ * paths known to be missing) get the status to send set here.
  *
- * @note After this function returns, client_sock will have been closed (i.e.
- * may not be used again).
- *
- * @param client_sock The client's socket file descriptor.
+ * @param job The new job; client_sock is set, everything else filled in here
  * @param root The directory root name
+ * @returns false if the client closed the connection (or the watchdog shut it
+ * down) before sending anything, so there is nothing to answer
  */
-void handleClient(const int client_sock, std::string root) {
+bool handleClient(Job &job, std::string root) {
 	// Step 1: Receive the request message from the client
 	char received_data[BUFFER_SIZE];
-	int bytes_received = receiveData(client_sock, received_data, BUFFER_SIZE);
+	int bytes_received = receiveData(job.client_sock, received_data, BUFFER_SIZE);
+	if(bytes_received == 0) {
+		return false;
+	}
 
 	// Turn the char array into a C++ string for easier processing.
 	string request_string(received_data, bytes_received);
 
+	// a full buffer without the end of the request line (or the blank line
+	// that ends the headers) means the client sent more than we accept
+	bool buffer_full = (bytes_received == BUFFER_SIZE);
+	size_t line_end = request_string.find("\r\n");
+	if(buffer_full && line_end == std::string::npos) {
+		job.status = 414;
+		return true;
+	}
+	if(buffer_full && request_string.find("\r\n\r\n") == std::string::npos) {
+		job.status = 431;
+		return true;
+	}
+
 	if(!validGET(request_string)) { // test for bad request
-		sendBad(client_sock);
-		return;
+		// a well formed request line with some other method is a 405
+		static const std::regex other_method_regex("^[A-Z]+ \\S+ HTTP/\\d\\.\\d");
+		bool other_method = std::regex_search(request_string.substr(0, line_end), other_method_regex)
+			&& request_string.compare(0, 4, "GET ") != 0;
+		job.status = other_method ? 405 : 400;
+		return true;
 	}
 	// tokenize path
 	std::istringstream f(request_string);
 	std::string filename;
 	getline(f, filename, ' ');
 	getline(f, filename, ' ');
-	
-	root.append(filename); // find directory with root
+	std::string version;
+	getline(f, version, '\r');
 
-	if(!fileExists(root) && !isDirectory(root)) { // test for valid directory/file
-		sendNotFound(client_sock);
-		sendError(client_sock);
-		return;
+	// split off the query string (e.g. "?format=json") from the path
+	std::string query;
+	size_t query_start = filename.find('?');
+	if(query_start != std::string::npos) {
+		query = filename.substr(query_start + 1);
+		filename.erase(query_start);
 	}
-	
-	// generates HTTP response based on request
-	// response is split into header and data
-	sendOK(client_sock);
 
-	if(isDirectory(root)) { // send the HTML data for the directory
-		sendHTML(client_sock, root);
+	// decode and normalize the path; from here on it is canonical, so the
+	// same file always gets the same cache keys however it was requested
+	if(!normalizeRequestPath(filename, filename)) {
+		job.status = 400;
+		return true;
 	}
-	else if(fileExists(root)) { // send header and file data for file request
-		sendHeader(client_sock, root);
-		sendFile(client_sock, root);
+
+	job.path = filename;
+	job.query = query;
+	job.filename = root + filename; // find directory with root
+	job.wants_json = wantsJSON(request_string, query);
+
+	// 1xx responses may only be sent to HTTP/1.1 (and later) clients
+	job.early_hints_ok = (version != "HTTP/1.0");
+
+	if(path_filter.definitelyMissing(job.filename)) { // known missing, skip the disk
+		job.status = 404;
+	}
+	return true;
+}
+
+/**
+ * Work out what a job's path is: open it beneath the root, stat it, and for
+ * a directory find its index file or build its listing.
+ *
+ * @param job The job; its status, location, file or body are set
+ * @param may_block Whether this may wait on the disk. When false (on a network
+ * worker) the lookup only uses the dentry cache, and directory listings are
+ * left for the disk pool.
+ * @returns false if the job has to be resolved again with may_block set
+ */
+bool resolve(Job &job, bool may_block) {
+	// resolve the path beneath the root and find out what it is: these two
+	// calls are all the disk work a request for a regular file needs
+	FdCloser target{openBeneath(root_fd, job.path, !may_block)};
+	if(target.fd < 0 && errno == EAGAIN) {
+		return false;
+	}
+	struct stat info;
+	if(target.fd < 0 || fstat(target.fd, &info) != 0) {
+		if(errno == ENOENT || errno == ENOTDIR) {
+			path_filter.recordMissing(job.filename);
+		}
+		job.status = 404; // also for paths trying to leave the root
+	}
+	else if(S_ISDIR(info.st_mode) && job.path.back() != '/') { // directories need a trailing slash
+		job.location = encodePath(job.path + "/");
+		if(!job.query.empty()) {
+			job.location += "?" + job.query;
+		}
+	}
+	else if(S_ISDIR(info.st_mode) && job.wants_json) { // machine-readable listing
+		job.body = cachedListing(job, target.fd, info, may_block);
+		if(!job.body) {
+			return false;
+		}
+		job.content_type = "application/json";
+	}
+	else if(S_ISDIR(info.st_mode)) {
+		// check for an index file first and return this automatically if there is one
+		std::string index_name;
+		if(!findIndex(job.filename, target.fd, info, may_block, index_name)) {
+			return false;
+		}
+		FdCloser index{index_name.empty() ? -1 : openBeneath(target.fd, index_name, !may_block)};
+		if(index.fd < 0 && errno == EAGAIN && !index_name.empty()) {
+			return false;
+		}
+		struct stat index_info;
+		if(index.fd >= 0 && fstat(index.fd, &index_info) == 0 && S_ISREG(index_info.st_mode)) {
+			job.filename += index_name;
+			job.file_fd = index.fd;
+			job.info = index_info;
+			index.fd = -1; // the job owns it now
+		}
+		else { // the HTML listing for the directory
+			job.body = cachedListing(job, target.fd, info, may_block);
+			if(!job.body) { // the listing needs getdents
+				return false;
+			}
+			job.content_type = "text/html";
+		}
+	}
+	else if(S_ISREG(info.st_mode)) {
+		job.file_fd = target.fd;
+		job.info = info;
+		target.fd = -1; // the job owns it now
+	}
+	else { // devices, sockets and FIFOs aren't served
+		job.status = 404;
+	}
+
+	ContentCache &content_cache = shards[job.shard]->content_cache;
+	if(job.file_fd >= 0 && (size_t) job.info.st_size <= content_cache.maxObjectSize()) {
+		job.body = content_cache.get(job.filename, job.info);
+		if(job.body) {
+			job.cache = "hit";
+		}
+	}
+	job.resolved = true;
+	job.resolved_at = std::chrono::steady_clock::now();
+	return true;
+}
+
+/**
+ * Send as much of a job's response as can be sent without waiting on the
+ * disk. Files small enough for the content cache are served from memory,
+ * and read into it on a miss; when that miss is an HTML page, its assets
+ * are handed to the prefetcher. Larger files are sent with sendfile(), which
+ * copies straight from the page cache to the socket, one slice per call.
+ *
+ * @param job The job, either new or back from the disk pool
+ * @param root The directory root name
+ * @returns What to do with the job next
+ */
+NextStep respond(Job &job, std::string root) {
+	const int client_sock = job.client_sock;
+	Job::Stage last_stage = job.stage;
+	NodeShard &shard = *shards[job.shard];
+	ContentCache &content_cache = shard.content_cache;
+	job.stage = Job::RESOLVE; // anything else is set again below when needed
+
+	if(job.status == 0 && !job.resolved && !resolve(job, false)) {
+		return DISK_WORK;
+	}
+
+	if(job.status != 0) {
+		sendStatus(client_sock, job.status);
+		return DONE;
+	}
+	if(!job.location.empty()) {
+		sendRedirect(client_sock, job.location);
+		return DONE;
+	}
+	if(job.file_fd < 0) { // a directory listing
+		sendOK(client_sock, serverTiming(job));
+		sendPage(client_sock, job.content_type, *job.body);
+		return DONE;
+	}
+
+	// small files are sent from memory; read them in if that won't block,
+	// or have the pool do it (once, so a file that shrank can't loop)
+	if(!job.bulk && !job.body && (size_t) job.info.st_size <= content_cache.maxObjectSize()
+			&& last_stage != Job::READ) {
+		job.cache = "miss";
+		std::string contents(job.info.st_size, '\0');
+		if(!DiskPool::readNoWait(job.file_fd, contents)) {
+			job.stage = Job::READ;
+			return DISK_WORK;
+		}
+		job.body = content_cache.insert(job.filename, job.info, std::move(contents));
+		if(isHTML(job.filename)) {
+			shard.prefetcher.pageLoaded(job.filename, *job.body);
+		}
+	}
+
+	// bodies sent from the file go to the bulk lane, so they never hold up
+	// the workers answering everything else
+	if(!job.bulk && !job.body) {
+		job.bulk = true;
+		job.cache = "bypass";
+		return BULK_LANE;
+	}
+
+	if(!job.header_sent) {
+		bool hinted = job.early_hints_ok && isHTML(job.filename) &&
+				sendEarlyHints(client_sock, job.filename, root, shard.prefetcher);
+		sendOK(client_sock, serverTiming(job), hinted);
+		sendHeader(client_sock, job.filename, job.info);
+		job.header_sent = true;
+	}
+
+	if(job.body) {
+		sendData(client_sock, job.body->data(), job.body->length()); // send file data to client
+		sendData(client_sock, "\r\n", TRANSACTION_CLOSE); // tell client that we are done sending
+		return DONE;
+	}
+
+	/*
+	 * From here the socket is non-blocking, and each visit sends at most one
+	 * slice before the job goes to the back of the bulk lane. Concurrent
+	 * downloads take turns a slice at a time, and a client that can't keep
+	 * up waits in the lane's epoll set instead of holding a worker.
+	 */
+	int flags = fcntl(client_sock, F_GETFL);
+	if(!(flags & O_NONBLOCK)) {
+		fcntl(client_sock, F_SETFL, flags | O_NONBLOCK);
+	}
+
+	if(job.offset < job.info.st_size) { // send file data to client
+		off_t slice = std::min(STREAM_SLICE, job.info.st_size - job.offset);
+		// a slice the pool just read is sent whether or not it is still
+		// resident, so memory pressure can't bounce the job back forever
+		if(last_stage != Job::WARM && !DiskPool::isResident(job.file_fd, job.offset, slice)) {
+			// start the read now, so the disk is busy while the job waits
+			posix_fadvise(job.file_fd, job.offset, slice, POSIX_FADV_WILLNEED);
+			job.stage = Job::WARM;
+			return DISK_WORK;
+		}
+
+		ssize_t bytes = sendfile(client_sock, job.file_fd, &job.offset, slice);
+		if(bytes < 0 && errno == EINTR) {
+			return BULK_LANE;
+		}
+		if(bytes < 0 && errno == EAGAIN) {
+			return WAIT_WRITABLE;
+		}
+		if(bytes < 0) {
+			std::error_code ec(errno, std::generic_category());
+			throw std::system_error(ec, "sendfile failed");
+		}
+		if(bytes == 0) { // file shrank since we sent Content-Length
+			job.offset = job.info.st_size;
+		}
+		return BULK_LANE; // let the other transfers have a turn
+	}
+
+	// tell client that we are done sending; the offset counts the bytes of
+	// it already sent
+	off_t close_sent = job.offset - job.info.st_size;
+	ssize_t bytes = send(client_sock, "\r\n" + close_sent, TRANSACTION_CLOSE - close_sent, MSG_NOSIGNAL);
+	if(bytes < 0 && errno == EINTR) {
+		return BULK_LANE;
+	}
+	if(bytes < 0 && errno == EAGAIN) {
+		return WAIT_WRITABLE;
+	}
+	if(bytes < 0) {
+		std::error_code ec(errno, std::generic_category());
+		throw std::system_error(ec, "send failed");
+	}
+	job.offset += bytes;
+	return (job.offset - job.info.st_size < TRANSACTION_CLOSE) ? WAIT_WRITABLE : DONE;
+}
+
+/**
+ * Do the disk work a job was submitted to the disk pool for. Runs on a disk
+ * pool thread; the job then goes back to a network worker.
+ *
+ * @param job The job, with its stage set by respond()
+ */
+void diskWork(Job &job) {
+	NodeShard &shard = *shards[job.shard];
+	ContentCache &content_cache = shard.content_cache;
+	try {
+		switch(job.stage) {
+			case Job::RESOLVE:
+				resolve(job, true);
+				// read a small file now too, rather than bouncing it back
+				if(job.file_fd < 0 || job.body || (size_t) job.info.st_size > content_cache.maxObjectSize()) {
+					break;
+				}
+				job.stage = Job::READ;
+				// fall through
+			case Job::READ: {
+				job.cache = "miss";
+				std::string contents(job.info.st_size, '\0');
+				size_t done = 0;
+				while(done < contents.size()) {
+					ssize_t bytes = pread(job.file_fd, &contents[done], contents.size() - done, done);
+					if(bytes < 0 && errno == EINTR) {
+						continue;
+					}
+					if(bytes <= 0) { // error, or file shrank; respond() uses sendfile
+						return;
+					}
+					done += bytes;
+				}
+				job.body = content_cache.insert(job.filename, job.info, std::move(contents));
+				if(isHTML(job.filename)) {
+					shard.prefetcher.pageLoaded(job.filename, *job.body);
+				}
+				break;
+			}
+			case Job::WARM: // readahead() returns once the slice is read
+				readahead(job.file_fd, job.offset, std::min(STREAM_SLICE, job.info.st_size - job.offset));
+				break;
+		}
+	}
+	catch(const fs::filesystem_error &e) { // e.g. a directory we can't read
+		std::cerr << e.what() << "\n";
+		job.status = 500;
 	}
-	// Close connection with client.
-	close(client_sock);
 }
 
 /**
  * Creates a new socket and starts listening on that socket for new
  * connections.
  *
+ * @param address The numeric IPv4 or IPv6 address to bind to.
  * @param port_num The port number on which to listen for connections.
- * @returns The socket file descriptor
+ * @param v6only For IPv6 addresses, whether to refuse IPv4-mapped connections.
+ * @param reuse_port Whether other sockets may listen on the same address
+ * (SO_REUSEPORT), with the kernel spreading connections between them.
+ * @returns The socket file descriptor, or -1 if the address family is not
+ * supported on this host.
  */
-int createSocketAndListen(const int port_num) {
-	int sock = socket(AF_INET, SOCK_STREAM, 0);
+int createSocketAndListen(const std::string &address, const int port_num, bool v6only,
+		bool reuse_port) {
+	/*
+	 * Turn the address string into an address structure. getaddrinfo works
+	 * out whether it is IPv4 or IPv6 for us; AI_NUMERICHOST keeps it from
+	 * doing any DNS lookups, and AI_PASSIVE means the result is for bind().
+	 */
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+
+	struct addrinfo *addr;
+	std::string port_str = std::to_string(port_num);
+	int gai_retval = getaddrinfo(address.c_str(), port_str.c_str(), &hints, &addr);
+	if (gai_retval != 0) {
+		std::cerr << "Bad listen address " << address << ": " << gai_strerror(gai_retval) << "\n";
+		exit(1);
+	}
+
+	int sock = socket(addr->ai_family, SOCK_STREAM, 0);
+	if (sock < 0 && errno == EAFNOSUPPORT) {
+		freeaddrinfo(addr);
+		return -1;
+	}
 	if (sock < 0) {
 		perror("Creating socket failed");
 		exit(1);
@@ -227,27 +1018,36 @@ int createSocketAndListen(const int port_num) {
 		exit(1);
 	}
 
+	if (reuse_port) {
+		retval = setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse_true,
+				sizeof(reuse_true));
+		if (retval < 0) {
+			perror("Setting SO_REUSEPORT failed");
+			exit(1);
+		}
+	}
+
 	/*
-	 * Create an address structure.  This is very similar to what we saw on the
-	 * client side, only this time, we're not telling the OS where to connect,
-	 * we're telling it to bind to a particular address and port to receive
-	 * incoming connections.  Like the client side, we must use htons() to put
-	 * the port number in network byte order.  When specifying the IP address,
-	 * we use a special constant, INADDR_ANY, which tells the OS to bind to all
-	 * of the system's addresses.  If your machine has multiple network
-	 * interfaces, and you only wanted to accept connections from one of them,
-	 * you could supply the address of the interface you wanted to use here.
+	 * Linux lets an IPv6 socket also accept IPv4 connections, which show up
+	 * as IPv4-mapped addresses (::ffff:a.b.c.d). Set IPV6_V6ONLY explicitly
+	 * rather than relying on the system default (net.ipv6.bindv6only).
 	 */
-	struct sockaddr_in addr;
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(port_num);
-	addr.sin_addr.s_addr = INADDR_ANY;
+	if (addr->ai_family == AF_INET6) {
+		int v6only_flag = v6only ? 1 : 0;
+		retval = setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6only_flag,
+				sizeof(v6only_flag));
+		if (retval < 0) {
+			perror("Setting IPV6_V6ONLY failed");
+			exit(1);
+		}
+	}
 
 	/* 
 	 * As its name implies, this system call asks the OS to bind the socket to
 	 * address and port specified above.
 	 */
-	retval = bind(sock, (struct sockaddr*)&addr, sizeof(addr));
+	retval = bind(sock, addr->ai_addr, addr->ai_addrlen);
+	freeaddrinfo(addr);
 	if (retval < 0) {
 		perror("Error binding to port");
 		exit(1);
@@ -273,15 +1073,10 @@ int createSocketAndListen(const int port_num) {
  * Sit around forever accepting new connections from client.
  *
  * @param server_sock The socket used by the server.
- * @param root The directory root name
+ * @param buffer The buffer shared with the worker threads
+ * @param limiter Tracks how many connections each client has open
  */
-void acceptConnections(const int server_sock, std::string root) {
-	BoundedBuffer buffer(CAPACITY);
-	for(size_t i = 0; i < NUM_THREADS; i++) { // creates threads based on NUM_THREADS (8)
-		std::thread cons(consume, std::ref(buffer), root);
-		cons.detach();
-	}
-
+void acceptConnections(const int server_sock, BoundedBuffer &buffer, ClientLimiter &limiter) {
 	while (true) {
 		// Declare a socket for the client connection.
 		int sock;
@@ -291,8 +1086,8 @@ void acceptConnections(const int server_sock, std::string root) {
 		 * fill it in, when we accept a connection, to tell us where the
 		 * connection came from.
 		 */
-		struct sockaddr_in remote_addr;
-		unsigned int socklen = sizeof(remote_addr); 
+		struct sockaddr_storage remote_addr; // big enough for IPv4 or IPv6
+		socklen_t socklen = sizeof(remote_addr);
 
 		/* 
 		 * Accept the first waiting connection from the server socket and
@@ -307,6 +1102,33 @@ void acceptConnections(const int server_sock, std::string root) {
 			exit(1);
 		}
 
+		/*
+		 * Turn away clients that already hold their share of connections
+		 * before they take up a spot in the buffer or a worker thread.
+		 */
+		if (!limiter.acquire(sock, remote_addr)) {
+			sendTooMany(sock);
+			close(sock);
+			continue;
+		}
+
+		/*
+		 * In busy-poll mode, have receives on the socket spin on the NIC's
+		 * queue instead of waiting for an interrupt. Raising SO_BUSY_POLL
+		 * above net.core.busy_read needs CAP_NET_ADMIN; without it the
+		 * worker-side spinning still applies.
+		 */
+		if (busy_poll_usecs > 0) {
+			int prefer = 1;
+			if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_usecs, sizeof(busy_poll_usecs)) < 0
+					|| setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) < 0) {
+				static std::atomic<bool> warned(false);
+				if (!warned.exchange(true)) {
+					perror("Setting busy poll socket options failed");
+				}
+			}
+		}
+
 		/* 
 		 * At this point, you have a connected socket (named sock) that you can
 		 * use to send() and recv(). The handleClient function should handle all
@@ -317,19 +1139,120 @@ void acceptConnections(const int server_sock, std::string root) {
 }
 
 /**
- * Allows threads to wait until a client socket is ready
- * handleClient is called when socket is ready.
- * Producer threads add to buffer
- * Consumer threads take out of buffer
+ * Network worker thread loop, serving the connections of one node's shard.
+ * Fast lane workers wait (in poll) on the
+ * eventfds of both the buffer of new connections and the fast lane's queue
+ * of jobs back from the disk pool, and serve whichever is ready; jobs already
+ * under way are taken first. Bulk lane workers only take jobs from the bulk
+ * lane, so large transfers never tie up the workers that answer everything
+ * else, and small requests never wait behind them. Spinning workers (see
+ * SpinWait) poll their queues in a loop for a while before they block.
  *
- * @param buffer An instance of the BoundedBuffer class that is shared by
- * threads
+ * @param shard_index Which shard in shards this worker belongs to
+ * @param limiter Tracks how many connections each client has open
  * @param root The directory root name
+ * @param bulk_worker Whether this worker serves the bulk lane
+ * @param spinning Whether to spin when idle (busy-poll mode, on a CPU of
+ * the worker's own)
  */
-void consume(BoundedBuffer &buffer, std::string root) {
+void consume(int shard_index, ClientLimiter &limiter, std::string root, bool bulk_worker,
+		bool spinning) {
+	NodeShard &shard = *shards[shard_index];
+	BoundedBuffer &buffer = shard.buffer; // shared by the node's threads
+	CompletionQueue &fast_lane = shard.fast_lane; // jobs for the fast lane workers
+	CompletionQueue &bulk_lane = shard.bulk_lane; // jobs with large file bodies
+	CompletionQueue &lane = bulk_worker ? bulk_lane : fast_lane;
+	struct pollfd ready[2] = {
+		{lane.eventFd(), POLLIN, 0},
+		{buffer.eventFd(), POLLIN, 0},
+	};
+	nfds_t num_ready = bulk_worker ? 1 : 2;
+	SpinWait spin;
+	Watchdog::Progress &progress = watchdog.addWorker((bulk_worker ? "bulk worker on node " : "fast worker on node ")
+			+ std::to_string(shard.node.id));
 	while(true) {
-		int shared_socket = buffer.getItem(); // buffer has shared socket
-		handleClient(shared_socket, root); // handleClient is called when a client socket is ready
+		// check the lock-free counts first, so an idle spinning worker stays
+		// off the locks the acceptor and disk pool take, and out of epoll_wait
+		std::unique_ptr<Job> job;
+		if(lane.mayHaveJobs()) {
+			job = lane.tryPop();
+		}
+		int shared_socket;
+		bool new_client = false;
+		std::chrono::steady_clock::time_point accepted;
+		if(!job && !bulk_worker && buffer.hasItems()
+				&& buffer.tryGetItem(shared_socket, accepted)) { // buffer has shared socket
+			job = std::make_unique<Job>();
+			job->client_sock = shared_socket;
+			job->accepted = accepted;
+			job->picked_up = std::chrono::steady_clock::now();
+			job->shard = shard_index;
+			new_client = true;
+		}
+		if(!job) {
+			if(!spinning || !spin.idle()) {
+				poll(ready, num_ready, bulk_worker ? PARK_CHECK_MS : -1);
+			}
+			continue;
+		}
+		spin.busy();
+
+		try {
+			if(job->timed_out) {
+				throw std::system_error(std::make_error_code(std::errc::timed_out),
+						"client stopped reading " + job->path);
+			}
+			bool got_request = true;
+			if(new_client) {
+				progress.begin(job->client_sock, Watchdog::RECEIVING, "");
+				got_request = handleClient(*job, root);
+				job->parsed = std::chrono::steady_clock::now();
+			}
+			NextStep next = DONE; // a client that closed without a request gets no answer
+			if(got_request) {
+				progress.begin(job->client_sock, Watchdog::RESPONDING, job->path);
+				next = respond(*job, root);
+			}
+			progress.end(); // before another thread can take the job
+			if(next == DISK_WORK && shard.disk_pool.trySubmit(job)) {
+				continue;
+			}
+			if(next == DISK_WORK && job->header_sent) {
+				// the disk pool is full mid-transfer: send the slice without
+				// warming it first (its stage stays WARM), on the bulk lane
+				bulk_lane.push(std::move(job));
+				continue;
+			}
+			if(next == DISK_WORK) { // the disk is too far behind, don't wait for it
+				sendStatus(job->client_sock, 503);
+			}
+			if(next == BULK_LANE) {
+				bulk_lane.push(std::move(job));
+				continue;
+			}
+			if(next == WAIT_WRITABLE) {
+				bulk_lane.pushWhenWritable(std::move(job));
+				continue;
+			}
+		}
+		catch(const fs::filesystem_error &e) { // e.g. a directory we can't read
+			std::cerr << e.what() << "\n";
+			if(!job->header_sent) {
+				const std::string &response = status_responses.at(500);
+				send(job->client_sock, response.c_str(), response.length(), MSG_NOSIGNAL);
+			}
+		}
+		catch(const std::system_error &e) { // client went away mid-request
+			std::cerr << e.what() << "\n";
+		}
+		// Close connection with client, releasing its slot first since the
+		// fd number can be reused as soon as it is closed
+		progress.end();
+		if(job->file_fd >= 0) {
+			close(job->file_fd);
+		}
+		limiter.release(job->client_sock);
+		close(job->client_sock);
 	}
 }
 
@@ -341,7 +1264,7 @@ void consume(BoundedBuffer &buffer, std::string root) {
  */
 bool validGET(std::string request) {
 	// checks for GET regex pattern
-	std::regex http_request_regex("(GET\\s[\\w\\-\\./]*\\sHTTP/\\d\\.\\d)");
+	static const std::regex http_request_regex("(GET\\s[\\w\\-\\./%~!$&'()*+,;=:@]*(\\?[^\\s#]*)?\\sHTTP/\\d\\.\\d)");
 	std::smatch match;
 
 	if(std::regex_search(request, match, http_request_regex)) { // if valid request
@@ -353,74 +1276,160 @@ bool validGET(std::string request) {
 }
 
 /**
- * Check for file in the root directory
+ * Read the regular files and directories inside an open directory
  *
- * @param filename Requested file
- * @returns true File exists in root directory
+ * @param dir_fd The directory's file descriptor
+ * @returns Its entries, in the order the file system returns them
  */
-bool fileExists(std::string filename) {
-	std::ifstream f(filename.c_str());
-	return f.good(); // returns true if no errors in ifstream
+vector<DirEntry> listDirectory(int dir_fd) {
+	vector<DirEntry> entries;
+
+	// fdopendir takes ownership of the fd it is given, so give it a copy
+	DIR *dir = fdopendir(dup(dir_fd));
+	if(dir == nullptr) {
+		std::error_code ec(errno, std::generic_category());
+		throw fs::filesystem_error("reading directory failed", ec);
+	}
+	rewinddir(dir);
+
+	struct dirent *item;
+	while((item = readdir(dir)) != nullptr) {
+		std::string name = item->d_name;
+		if(name == "." || name == "..") {
+			continue;
+		}
+
+		struct stat info;
+		if(fstatat(dirfd(dir), item->d_name, &info, 0) != 0) { // entry vanished or unreadable
+			continue;
+		}
+		if(S_ISREG(info.st_mode) || S_ISDIR(info.st_mode)) {
+			entries.push_back(DirEntry{name, S_ISDIR(info.st_mode), info.st_size, info.st_mtime});
+		}
+	}
+	closedir(dir);
+	return entries;
 }
 
 /**
- * Check if requested directory exists and is in the root directory
+ * Build the complete response for every error or status code the server
+ * sends without a file, once, before any clients are served. The body comes
+ * from error_dir/(status).html when that file exists.
  *
- * @param filename Requested directory
- * @returns true Directory exists and ends in '/'
+ * @param error_dir Directory of custom error pages, or "" for none
  */
-bool isDirectory(std::string filename) {
-	return (fs::is_directory(filename));
+void buildStatusResponses(std::string error_dir) {
+	struct StatusInfo {
+		int status;
+		const char *reason;
+		const char *title;
+		const char *extra_headers;
+	};
+	const StatusInfo statuses[] = {
+		{400, "BAD REQUEST", "Bad Request", ""},
+		{404, "NOT FOUND", "Page Not Found", ""},
+		{405, "METHOD NOT ALLOWED", "Method Not Allowed", "Allow: GET\r\n"},
+		{413, "PAYLOAD TOO LARGE", "Payload Too Large", ""},
+		{414, "URI TOO LONG", "URI Too Long", ""},
+		{429, "TOO MANY REQUESTS", "Too Many Requests", "Retry-After: 1\r\n"},
+		{431, "REQUEST HEADER FIELDS TOO LARGE", "Request Header Fields Too Large", ""},
+		{500, "INTERNAL SERVER ERROR", "Internal Server Error", ""},
+		{503, "SERVICE UNAVAILABLE", "Service Unavailable", "Retry-After: 1\r\n"},
+	};
+
+	for(const StatusInfo &info : statuses) {
+		std::stringstream stream;
+		std::ifstream custom_page;
+		if(!error_dir.empty()) {
+			custom_page.open(error_dir + "/" + std::to_string(info.status) + ".html", std::ios::binary);
+		}
+
+		if(custom_page.is_open()) {
+			stream << custom_page.rdbuf();
+		}
+		else { // create error page
+			stream << "<html>" << "\r\n"
+				<< "<head>" << "\r\n"
+				<< "<title> " << info.title << "! </title>" << "\r\n"
+				<< "</head>" << "\r\n"
+				<< "<body> " << info.status << " " << info.title << "! </body>" << "\r\n"
+				<< "</html>" << "\r\n";
+		}
+
+		std::string error_page = stream.str();
+		std::stringstream resp;
+		// create package for error page
+		resp << "HTTP/1.0 " << info.status << " " << info.reason << "\r\n"
+			<< info.extra_headers
+			<< "Content-Type: " << "text/html" << "\r\n"
+			<< "Content-Length: " << error_page.length() << "\r\n"
+			<< "\r\n" << error_page << "\r\n";
+
+		status_responses[info.status] = resp.str();
+	}
 }
 
 /**
- * Send an HTTP 400 BAD REQUEST response
+ * Send one of the prebuilt error or status responses
  *
  * @param client_sock Client's socket file descriptor
+ * @param status HTTP status code, one of those made by buildStatusResponses
  */
-void sendBad(const int client_sock) {
-	std::string request = "HTTP/1.0 400 BAD REQUEST\r\n";
-	sendData(client_sock, request.c_str(), request.length()); // send response to client
+void sendStatus(const int client_sock, int status) {
+	const std::string &response = status_responses.at(status);
+	sendData(client_sock, response.c_str(), response.length()); // send response to client
 }
 
 /**
- * Send an HTTP 404 NOT FOUND response
+ * Send an HTTP 429 TOO MANY REQUESTS response to a client that is over its
+ * connection limit. This runs on the accepting thread, so it never waits: the
+ * response nearly always fits in a new socket's send buffer, and if it does
+ * not the client simply sees the connection close.
  *
  * @param client_sock Client's socket file descriptor
  */
-void sendNotFound(const int client_sock) {
-	std::string request = "HTTP/1.0 404 NOT FOUND\r\n";
-	sendData(client_sock, request.c_str(), request.length()); // send response to client
+void sendTooMany(const int client_sock) {
+	const std::string &response = status_responses.at(429);
+	send(client_sock, response.c_str(), response.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
 }
 
 /**
- * Send an HTTP 200 OK response
+ * Send an HTTP 200 OK response. It is an HTTP/1.0 response unless it follows
+ * an HTTP/1.1 103, in which case it keeps that version and closes explicitly.
  *
  * @param client_sock Client's socket file descriptor
+ * @param headers Extra header lines to send with it, each ending in CRLF
+ * @param after_hints true if 103 EARLY HINTS were just sent on this socket
  */
-void sendOK(const int client_sock) {
-	std::string request = "HTTP/1.0 200 OK\r\n";
+void sendOK(const int client_sock, const std::string &headers, bool after_hints) {
+	std::string status = after_hints ? "HTTP/1.1 200 OK\r\nConnection: close\r\n" : "HTTP/1.0 200 OK\r\n";
+	std::string request = status + headers;
 	sendData(client_sock, request.c_str(), request.length()); // send response to client
 }
 
 /**
- * Send requested file data
+ * Build the Server-Timing header for a job about to send its 200 response,
+ * with how long it spent waiting for a worker, being parsed, having its path
+ * resolved and getting its body ready (from the cache, read in, or left for
+ * sendfile), and the total up to now, in milliseconds
  *
- * @param client_sock Client's socket file descriptor
- * @param filename Requested file
+ * @param job The job
+ * @returns The header line, or "" when -t is off
  */
-void sendFile(const int client_sock, std::string filename) {
-	std::ifstream file(filename, std::ios::binary); // open file
-	const unsigned int buff_size = 4096;
-	char data[buff_size]; // create buffer to store data
-
-	while(!file.eof()) { // read through file, capturing contents
-		file.read(data, buff_size);
-		int bytes = file.gcount();
-		sendData(client_sock, data, bytes); // send file data to client
+std::string serverTiming(const Job &job) {
+	if(!server_timing) {
+		return "";
 	}
-	file.close(); // close file
-	sendData(client_sock, "\r\n", TRANSACTION_CLOSE); // tell client that we are done sending
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	auto ms = [](std::chrono::steady_clock::duration d) {
+		return std::chrono::duration<double, std::milli>(d).count();
+	};
+	char header[256];
+	snprintf(header, sizeof(header), "Server-Timing: queue;dur=%.3f, parse;dur=%.3f, resolve;dur=%.3f, "
+			"cache;desc=\"%s\";dur=%.3f, send-start;dur=%.3f\r\n",
+			ms(job.picked_up - job.accepted), ms(job.parsed - job.picked_up), ms(job.resolved_at - job.parsed),
+			job.cache, ms(now - job.resolved_at), ms(now - job.accepted));
+	return header;
 }
 
 /**
@@ -428,46 +1437,43 @@ void sendFile(const int client_sock, std::string filename) {
  *
  * @param client_sock Client's socket file descriptor
  * @param filename Requested file
+ * @param info The file's stat
  */
-void sendHeader(const int client_sock, std::string filename) {
-	std::regex rgx("(\\.\\w*)"); // regex to check for file extension
-	std::smatch match;
+void sendHeader(const int client_sock, std::string filename, const struct stat &info) {
+	// file extension of the last path component only, so dots in
+	// directory names (e.g. a root of "./WWW") don't count
+	std::string extension = fs::path(filename).extension().string();
 	std::string type;
-	std::string size;
 
 	// match extension against most common file types
-	if(std::regex_search(filename, match, rgx)) {
-			if(match[0] == ".html") { // match against html
+	{
+			if(extension == ".html" || extension == ".htm") { // match against html
 			type = "text/html";
 			}
-			else if(match[0] == ".css") { // match against css
+			else if(extension == ".css") { // match against css
 			type = "text/css";
 			}
-			else if(match[0] == ".jpg") { // match against jpg
+			else if(extension == ".jpg") { // match against jpg
 			type = "image/jpeg";
 			}
-			else if(match[0] == ".gif") { // match against gif
+			else if(extension == ".gif") { // match against gif
 			type = "image/gif";
 			}
-			else if(match[0] == ".png") { // match against png
+			else if(extension == ".png") { // match against png
 			type = "image/png";
 			}
-			else if(match[0] == ".pdf") { // match against pdf
+			else if(extension == ".pdf") { // match against pdf
 			type = "application/pdf";
 			}
 			else { // assume txt file
 			type = "text/plain";
 			}
 	}
-	else { // if no match
-		std::cout << "No Matches!";
-		return;
-	}
 
 	// capture file type and content length, send information back to client
 	std::stringstream stream;
 	stream << "Content-Type: " << type << "\r\n"
-		<< "Content-Length: " << std::to_string(fs::file_size(filename)) << "\r\n"
+		<< "Content-Length: " << std::to_string(info.st_size) << "\r\n"
 		<< "\r\n";
 
 	std::string response = stream.str();
@@ -478,91 +1484,296 @@ void sendHeader(const int client_sock, std::string filename) {
  * Generate HTML file that lists files or directories inside of specified
  * directory
  *
- * @param client_sock Client's socket file descriptor
- * @param filename Requested file
+ * @param dir_fd Open fd of the requested directory
+ * @returns The HTML page
  */
-void sendHTML(const int client_sock, std::string filename) {
+std::string htmlListing(int dir_fd) {
 	std::stringstream stream;
 
-	if(!isDirectory(filename) && fileExists(filename)) { // if file or directory is not found sned error page
-		stream << "<html>" << "\r\n"
-			<< "<head>" << "\r\n"
-			<< "<title> Page not found! </title>" << "\r\n"
-			<< "</head>" << "\r\n"
-			<< "<body> 404 Page Not Found! </body>" << "\r\n"
-			<< "</html>" << "\r\n";
-
-		std::string error_page = stream.str();
-		std::stringstream resp;
-		resp << "Content-Type: " << "text/html" << "\r\n"
-			<< "Content-Length: " << error_page.length() << "\r\n"
-			<< "\r\n" << error_page << "\r\n";
-
-		std::string sendPage = resp.str();
-		sendData(client_sock, sendPage.c_str(), sendPage.length()); // send error page to client to display
-		return;
-	}
 	// generate HTML directory page
 	stream << "<html>" << "\r\n"
 		<< "<head>" << "<title></title>" << "</head>" << "\r\n"
 		<< "<body>" << "\r\n"
 		<< "<ul>" << "\r\n";
-	
+
 	// for each file entry in the specified directory
-	for(auto& item: fs::directory_iterator(filename)) {
-		if(item.path().filename() == "index.html") { // check for 'index.html' first and return this automatically if there is a match
-			sendHeader(client_sock, item.path());
-			sendFile(client_sock, item.path());
-			return;
-		}
+	for(const DirEntry &item : listDirectory(dir_fd)) {
 		// check filenames and add all files
-		else if(fs::is_regular_file(filename + item.path().filename().string())) {
-			stream << "\t<li><a href=\"" << item.path().filename().string() << "\">" << item.path().filename().string() << "</a></li>\r\n";
+		if(!item.is_dir) {
+			stream << "\t<li><a href=\"" << item.name << "\">" << item.name << "</a></li>\r\n";
 		}
-		else if(fs::is_directory(filename + item.path().filename().string())) {
-			stream << "\t<li><a href=\"" << item.path().filename().string() << "/\">" << item.path().filename().string() << "/</a></li>\r\n";
+		else {
+			stream << "\t<li><a href=\"" << item.name << "/\">" << item.name << "/</a></li>\r\n";
 		}
-	}	
+	}
 	stream << "</ul>" << "\r\n"
 		<< "</body>" << "\r\n"
 		<< "</html>" << "\r\n";
 
-	std::string html_page = stream.str();
-	std::stringstream resp2;
+	return stream.str();
+}
+
+/**
+ * Send the headers and body of a generated page, such as a listing
+ *
+ * @param client_sock Client's socket file descriptor
+ * @param type Content type of the page
+ * @param page The page
+ */
+void sendPage(const int client_sock, std::string type, const std::string &page) {
+	std::stringstream resp;
 
 	// create header info
-	resp2 << "Content-Type: " << "text/html" << "\r\n"
-		<< "Content-Length: " << html_page.length() << "\r\n"
-		<< "\r\n" << html_page << "\r\n";
+	resp << "Content-Type: " << type << "\r\n"
+		<< "Content-Length: " << page.length() << "\r\n"
+		<< "\r\n" << page << "\r\n";
+
+	std::string response = resp.str();
+	sendData(client_sock, response.c_str(), response.length()); // send content type and length to client
+}
+
+/**
+ * Find the index file to serve for a directory by probing each of the
+ * configured index names directly, rather than reading the whole directory.
+ * Results are cached until the directory's modification time changes, which
+ * happens whenever an entry is created, removed or renamed inside it.
+ *
+ * @param dirname Requested directory, ending in '/' (used as the cache key)
+ * @param dir_fd Open fd of the directory
+ * @param dir_info The directory's stat
+ * @param may_block Whether probing the disk is allowed on a cache miss
+ * @param index_name Set to the first index file that exists, or "" if there
+ * is none
+ * @returns false if the answer isn't cached and may_block is false
+ */
+bool findIndex(std::string dirname, int dir_fd, const struct stat &dir_info, bool may_block,
+		std::string &index_name) {
+	{
+		std::lock_guard<std::mutex> lock(index_cache_mutex);
+		auto cached = index_cache.find(dirname);
+		if(cached != index_cache.end()
+				&& cached->second.dir_mtime.tv_sec == dir_info.st_mtim.tv_sec
+				&& cached->second.dir_mtime.tv_nsec == dir_info.st_mtim.tv_nsec) {
+			index_name = cached->second.index_name;
+			return true;
+		}
+	}
+	if(!may_block) {
+		return false;
+	}
+
+	// probe each name relative to the directory; the first regular file wins
+	index_name.clear();
+	for(const std::string &name : index_files) {
+		struct stat info;
+		if(fstatat(dir_fd, name.c_str(), &info, 0) == 0 && S_ISREG(info.st_mode)) {
+			index_name = name;
+			break;
+		}
+	}
 
-	std::string sendPage2 = resp2.str();
-	sendData(client_sock, sendPage2.c_str(), sendPage2.length()); // send content type and length to client
+	std::lock_guard<std::mutex> lock(index_cache_mutex);
+	index_cache[dirname] = IndexEntry{dir_info.st_mtim, index_name};
+	return true;
 }
 
 /**
- * Send error page to client if their request cannot be found
+ * Send an HTTP 301 MOVED PERMANENTLY response pointing at a new location
  *
  * @param client_sock Client's socket file descriptor
+ * @param location Path the client should request instead
  */
-void sendError(const int client_sock) {
-	std::cout << "Error!!!";
+void sendRedirect(const int client_sock, std::string location) {
 	std::stringstream stream;
-	// create error page
-	stream << "<html>" << "\r\n"
-           << "<head>" << "\r\n"
-           << "<title> Page not found! </title>" << "\r\n"
-           << "</head>" << "\r\n"
-           << "<body> 404 Page Not Found! </body>" << "\r\n"
-           << "</html>" << "\r\n";
-	
-	std::string error_page = stream.str();
-	std::stringstream resp;
-	// create package for error page
-	resp << "Content-Type: " << "text/html" << "\r\n"
-         << "Content-Length: " << error_page.length() << "\r\n"
-         << "\r\n" << error_page << "\r\n";
-
-	std::string sendPage = resp.str();
-	sendData(client_sock, sendPage.c_str(), sendPage.length()); // send error page to client
-	return;
+	stream << "HTTP/1.0 301 MOVED PERMANENTLY\r\n"
+		<< "Location: " << location << "\r\n"
+		<< "Content-Length: 0\r\n"
+		<< "\r\n";
+
+	std::string response = stream.str();
+	sendData(client_sock, response.c_str(), response.length()); // send response to client
+}
+
+/**
+ * Send an HTTP 103 EARLY HINTS response listing the stylesheets, images and
+ * scripts an HTML page is known to use, so the client can start fetching them
+ * while we send the page itself. Nothing is sent until the page has been
+ * served once and its assets are in the prefetcher's dependency graph.
+ *
+ * @param client_sock Client's socket file descriptor
+ * @param page Path of the HTML file about to be sent
+ * @param root The directory root name, for turning asset paths into URLs
+ * @param prefetcher Knows which assets the page uses
+ * @returns true if hints were sent, so the 200 must be HTTP/1.1 as well
+ */
+bool sendEarlyHints(const int client_sock, std::string page, std::string root,
+		AssetPrefetcher &prefetcher) {
+	vector<string> assets = prefetcher.dependencies(page);
+
+	std::stringstream stream;
+	for(const std::string &asset : assets) {
+		// preload needs a destination type, anything else is not worth hinting
+		std::string extension = fs::path(asset).extension().string();
+		std::string as;
+		if(extension == ".css") {
+			as = "style";
+		}
+		else if(extension == ".js") {
+			as = "script";
+		}
+		else if(extension == ".jpg" || extension == ".gif" || extension == ".png") {
+			as = "image";
+		}
+		else {
+			continue;
+		}
+
+		std::string url = encodePath(asset.substr(root.length())); // assets are root + request path
+		stream << "Link: <" << url << ">; rel=preload; as=" << as << "\r\n";
+	}
+
+	std::string links = stream.str();
+	if(links.empty()) {
+		return false;
+	}
+	std::string response = "HTTP/1.1 103 EARLY HINTS\r\n" + links + "\r\n";
+	sendData(client_sock, response.c_str(), response.length()); // send hints to client
+	return true;
+}
+
+/**
+ * Check whether a file is an HTML page, going by its extension
+ *
+ * @param filename Path of the file
+ * @returns true File ends in .html or .htm
+ */
+bool isHTML(std::string filename) {
+	std::string extension = fs::path(filename).extension().string();
+	return extension == ".html" || extension == ".htm";
+}
+
+/**
+ * Split a comma separated command line value into its items
+ *
+ * @param list Comma separated list (e.g. "index.html,index.htm")
+ * @returns The non-empty items in order
+ */
+vector<string> splitList(std::string list) {
+	vector<string> items;
+	std::istringstream stream(list);
+	std::string item;
+	while(getline(stream, item, ',')) {
+		if(!item.empty()) {
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+/**
+ * Check whether the client asked for a JSON directory listing, either through
+ * a "format=json" query parameter or an Accept header naming application/json
+ *
+ * @param request Request message from client
+ * @param query Query string of the request target (without the '?')
+ * @returns true Client wants the JSON listing instead of HTML
+ */
+bool wantsJSON(std::string request, std::string query) {
+	// look for format=json among the '&' separated query parameters
+	std::istringstream params(query);
+	std::string param;
+	while(getline(params, param, '&')) {
+		if(param == "format=json") {
+			return true;
+		}
+	}
+
+	// header names are case-insensitive, so match Accept with icase
+	static const std::regex accept_regex("\r\nAccept:[^\r\n]*application/json", std::regex::icase);
+	return std::regex_search(request, accept_regex);
+}
+
+/**
+ * Escape a string so it can be placed inside a JSON string literal
+ *
+ * @param text Raw text (e.g. a file name)
+ * @returns The escaped text, without surrounding quotes
+ */
+std::string jsonEscape(std::string text) {
+	std::string escaped;
+	for(unsigned char c : text) {
+		if(c == '"' || c == '\\') {
+			escaped += '\\';
+			escaped += c;
+		}
+		else if(c < 0x20) { // control characters must use \u escapes
+			char code[7];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped += code;
+		}
+		else {
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+/**
+ * Generate a JSON document listing the files and directories inside of the
+ * specified directory. Each entry has its name, type ("file" or "directory"),
+ * size in bytes and modification time in seconds since the epoch.
+ *
+ * @param dir_fd Open fd of the requested directory
+ * @returns The JSON document
+ */
+std::string jsonListing(int dir_fd) {
+	std::stringstream stream;
+	stream << "[";
+
+	bool first = true;
+	for(const DirEntry &item : listDirectory(dir_fd)) {
+		stream << (first ? "\r\n" : ",\r\n")
+			<< "\t{\"name\": \"" << jsonEscape(item.name) << "\", "
+			<< "\"type\": \"" << (item.is_dir ? "directory" : "file") << "\", "
+			<< "\"size\": " << item.size << ", "
+			<< "\"mtime\": " << item.mtime << "}";
+		first = false;
+	}
+	stream << "\r\n]\r\n";
+
+	return stream.str();
+}
+
+/**
+ * Get a directory's listing (JSON if the job asked for it, HTML otherwise)
+ * from the content cache, building and caching it on a miss. Listings are
+ * keyed by the directory's stat, so adding, removing or renaming an entry
+ * makes them miss.
+ *
+ * @param job The job asking for the listing; its cache outcome is set
+ * @param dir_fd Open fd of the directory
+ * @param dir_info The directory's stat
+ * @param may_block Whether building the listing (getdents) is allowed
+ * @returns The listing, or nullptr on a miss when may_block is false
+ */
+std::shared_ptr<const std::string> cachedListing(Job &job, int dir_fd, const struct stat &dir_info,
+		bool may_block) {
+	ContentCache &content_cache = shards[job.shard]->content_cache;
+	// no file path contains a NUL, so listings can't collide with files
+	std::string key = job.filename + '\0' + (job.wants_json ? "json" : "html");
+
+	std::shared_ptr<const std::string> listing = content_cache.get(key, dir_info);
+	if(listing) {
+		job.cache = "hit";
+	}
+	if(listing || !may_block) {
+		return listing;
+	}
+	job.cache = "miss";
+	std::string page = job.wants_json ? jsonListing(dir_fd) : htmlListing(dir_fd);
+	if(page.size() > content_cache.maxObjectSize()) {
+		return std::make_shared<const std::string>(std::move(page));
+	}
+	return content_cache.insert(key, dir_info, std::move(page),
+			job.wants_json ? JSON_LISTING_MAX_AGE : std::chrono::steady_clock::duration::zero());
 }